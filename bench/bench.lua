@@ -0,0 +1,212 @@
+-- Measures the throughput of functions of module 'memory' over sizes from
+-- 16 B up to 1 GiB, and of the equivalent functions of the string library.
+--
+-- Usage: lua bench/bench.lua [format [maxsize [mintime]]]
+--
+--   format   'csv' (default) or 'json'
+--   maxsize  largest size measured in bytes (default is 1 GiB)
+--   mintime  minimum time in seconds measuring each case (default is 0.2)
+
+local memory = require "memory"
+
+local format = arg[1] or "csv"
+local maxsize = math.tointeger(tonumber(arg[2])) or 1<<30
+local mintime = tonumber(arg[3]) or 0.2
+
+local fields = { "bench", "impl", "size", "iterations", "seconds", "ns_per_op", "mb_per_s" }
+
+local writers = {
+	csv = {
+		header = function () print(table.concat(fields, ",")) end,
+		row = function (result)
+			local values = {}
+			for i, field in ipairs(fields) do values[i] = tostring(result[field]) end
+			print(table.concat(values, ","))
+		end,
+		footer = function () end,
+	},
+	json = {
+		header = function () io.write('{"lua":"', _VERSION, '","results":[') end,
+		row = function (result, first)
+			local values = {}
+			for i, field in ipairs(fields) do
+				local value = result[field]
+				if not tonumber(value) then value = string.format("%q", value) end
+				values[i] = string.format('"%s":%s', field, value)
+			end
+			io.write(first and "\n" or ",\n", "{", table.concat(values, ","), "}")
+		end,
+		footer = function () io.write("\n]}\n") end,
+	},
+}
+
+local writer = assert(writers[format], "unknown format "..format)
+
+local function measure(f, ...)
+	local iterations = 1
+	while true do
+		collectgarbage()
+		local start = os.clock()
+		for _ = 1, iterations do f(...) end
+		local elapsed = os.clock()-start
+		if elapsed >= mintime then return iterations, elapsed end
+		iterations = iterations*2
+	end
+end
+
+local first = true
+
+local function report(bench, impl, size, f, ...)
+	local iterations, elapsed = measure(f, ...)
+	writer.row({
+		bench = bench,
+		impl = impl,
+		size = size,
+		iterations = iterations,
+		seconds = string.format("%.6f", elapsed),
+		ns_per_op = string.format("%.2f", elapsed*1e9/iterations),
+		mb_per_s = string.format("%.2f", size*iterations/elapsed/(1<<20)),
+	}, first)
+	first = false
+end
+
+local needle = "\r\n\r\n"
+
+local function contents(size)
+	local line = "0123456789abcdef\r\n"
+	return string.rep(line, size//#line+1):sub(1, size-#needle)..needle
+end
+
+-- cases that change the contents of 'data.m' must be the last ones
+local cases = {
+	{ "create",
+		memory = function (data) memory.create(data.size) end,
+		string = function (data) string.rep("\0", data.size) end,
+	},
+	{ "rep",
+		memory = function (data) memory.rep("abc", data.size//3) end,
+		string = function (data) string.rep("abc", data.size//3) end,
+	},
+	{ "resize",
+		memory = function (data) memory.resize(data.r, data.size); memory.resize(data.r, 0) end,
+	},
+	{ "find",
+		memory = function (data) memory.find(data.m, needle) end,
+		string = function (data) string.find(data.s, needle, 1, true) end,
+	},
+	{ "split",
+		memory = function (data) for _ in memory.split(data.m, "\n") do end end,
+		string = function (data) for _ in data.s:gmatch("[^\n]*") do end end,
+	},
+	{ "findbyte",
+		memory = function (data) memory.findbyte(data.m, "\0\t ;=") end,
+		string = function (data) data.s:find("[%z\t ;=]") end,
+	},
+	{ "diff",
+		memory = function (data) memory.diff(data.m, data.s) end,
+		string = function (data) return data.s < data.c end,
+	},
+	{ "crc32",
+		memory = function (data) memory.crc32(data.m) end,
+	},
+	{ "crc32c",
+		memory = function (data) memory.crc32c(data.m) end,
+	},
+	{ "xxhash64",
+		memory = function (data) memory.xxhash64(data.m) end,
+	},
+	{ "hex",
+		memory = function (data) memory.encode(data.e, 1, data.m, nil, nil, "hex") end,
+	},
+	{ "base64",
+		memory = function (data) memory.encode(data.e, 1, data.m, nil, nil, "base64") end,
+	},
+	{ "unpack",
+		memory = function (data) memory.unpack(data.m, data.fmt) end,
+		string = function (data) string.unpack(data.fmt, data.s) end,
+	},
+	{ "tostring",
+		memory = function (data) memory.tostring(data.m) end,
+		string = function (data) data.s:sub(2) end,
+	},
+	{ "builder",
+		maxsize = 1<<20,
+		memory = function (data)
+			local b = memory.builder()
+			for i = 1, data.size//16 do b:pack("<i8d", i, i) end
+		end,
+		string = function (data)
+			local t, pack = {}, string.pack
+			for i = 1, data.size//16 do t[i] = pack("<i8d", i, i) end
+			table.concat(t)
+		end,
+	},
+	{ "freeze",
+		memory = function (data)
+			local b = memory.builder()
+			b:add(data.m)
+			memory.freeze(b:memory())
+		end,
+		string = function (data)
+			local b = memory.builder()
+			b:add(data.m)
+			tostring(b)  -- copies the contents
+		end,
+	},
+	{ "get",
+		maxsize = 1<<16,
+		memory = function (data)
+			local get, m = memory.get, data.m
+			for i = 1, data.size do get(m, i) end
+		end,
+		string = function (data)
+			local byte, s = string.byte, data.s
+			for i = 1, data.size do byte(s, i) end
+		end,
+	},
+	{ "pack",
+		memory = function (data) memory.pack(data.m, data.fmt, 1, data.s) end,
+		string = function (data) string.pack(data.fmt, data.s) end,
+	},
+	{ "atomic",
+		maxsize = 1<<16,
+		memory = function (data)
+			local counter = memory.atomic(data.m, 1, "u64")
+			for i = 1, data.size do counter:add(1) end
+		end,
+	},
+	{ "set",
+		maxsize = 1<<16,
+		memory = function (data)
+			local set, m = memory.set, data.m
+			for i = 1, data.size do set(m, i, 0x41) end
+		end,
+	},
+	{ "bxor",
+		memory = function (data) memory.bxor(data.m, "\x5a\xa5\x3c\xc3") end,
+	},
+	{ "fill",
+		memory = function (data) memory.fill(data.m, "abc") end,
+		string = function (data) string.rep("abc", data.size//3+1) end,
+	},
+}
+
+writer.header()
+local size = 16
+while size <= maxsize do
+	local data = { size = size, fmt = "c"..size, r = memory.create() }
+	data.s = contents(size)
+	data.c = data.s:sub(1, -2).."\0"  -- differs only in the last byte
+	data.m = memory.create(data.s)
+	data.e = memory.create(2*size)  -- fits any encoding of 'data.m'
+	for _, case in ipairs(cases) do
+		if size <= (case.maxsize or maxsize) then
+			for _, impl in ipairs{ "memory", "string" } do
+				if case[impl] then report(case[1], impl, size, case[impl], data) end
+			end
+		end
+	end
+	data = nil
+	size = size*4
+end
+writer.footer()
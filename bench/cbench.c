@@ -0,0 +1,177 @@
+/*
+** Measures the throughput of functions of the C API over sizes from 16 B
+** up to 1 GiB, and of the equivalent functions of the C library. Results
+** are written in the same formats of 'bench.lua'.
+**
+** Usage: cbench [format [maxsize [mintime]]]
+*/
+
+#include "luamem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <lualib.h>
+
+
+typedef struct Bench {
+	lua_State *L;
+	size_t size;
+	char *src;
+	char *dst;
+	const luamem_Layout *layout;
+} Bench;
+
+typedef void (*BenchFunc) (Bench *b);
+
+static int json = 0;
+static int first = 1;
+static double mintime = 0.2;
+
+
+static void header (void) {
+	if (json) printf("{\"lua\":\"%s\",\"results\":[", LUA_VERSION);
+	else printf("bench,impl,size,iterations,seconds,ns_per_op,mb_per_s\n");
+}
+
+static void footer (void) {
+	if (json) printf("\n]}\n");
+}
+
+static void report (const char *bench, const char *impl, Bench *b,
+                    BenchFunc f) {
+	unsigned long iterations = 1, i;
+	double elapsed;
+	while (1) {
+		clock_t start;
+		lua_gc(b->L, LUA_GCCOLLECT);
+		start = clock();
+		for (i = 0; i < iterations; i++) f(b);
+		elapsed = (double)(clock()-start)/CLOCKS_PER_SEC;
+		if (elapsed >= mintime) break;
+		iterations *= 2;
+	}
+	if (json) printf("%s{\"bench\":\"%s\",\"impl\":\"%s\",\"size\":%lu,"
+	                 "\"iterations\":%lu,\"seconds\":%.6f,"
+	                 "\"ns_per_op\":%.2f,\"mb_per_s\":%.2f}",
+	                 first ? "\n" : ",\n", bench, impl,
+	                 (unsigned long)b->size, iterations, elapsed,
+	                 elapsed*1e9/iterations,
+	                 (double)b->size*iterations/elapsed/(1<<20));
+	else printf("%s,%s,%lu,%lu,%.6f,%.2f,%.2f\n", bench, impl,
+	            (unsigned long)b->size, iterations, elapsed,
+	            elapsed*1e9/iterations,
+	            (double)b->size*iterations/elapsed/(1<<20));
+	first = 0;
+}
+
+
+static void bench_newalloc (Bench *b) {
+	luamem_newalloc(b->L, b->size);
+	lua_pop(b->L, 1);
+}
+
+static void bench_malloc (Bench *b) {
+	volatile char *mem = (volatile char *)malloc(b->size);
+	if (mem) mem[0] = 0;  /* avoid the allocation to be optimized out */
+	free((void *)mem);
+}
+
+static void bench_addvalue (Bench *b) {
+	luaL_Buffer B;
+	luaL_buffinit(b->L, &B);
+	lua_pushvalue(b->L, 1);
+	luamem_addvalue(&B);
+	luaL_pushresult(&B);
+	lua_pop(b->L, 1);
+}
+
+/* size of the chunks added to buffers */
+#define CHUNK	64
+
+static void bench_buffer (Bench *b) {
+	luamem_Buffer B;
+	size_t i;
+	luamem_buffinit(b->L, &B);
+	for (i = 0; i+CHUNK <= b->size; i += CHUNK)
+		luamem_addlstring(&B, b->src+i, CHUNK);
+	luamem_pushresult(&B);
+	lua_pop(b->L, 1);
+}
+
+static void bench_luabuffer (Bench *b) {
+	luaL_Buffer B;
+	size_t i;
+	luaL_buffinit(b->L, &B);
+	for (i = 0; i+CHUNK <= b->size; i += CHUNK)
+		luaL_addlstring(&B, b->src+i, CHUNK);
+	luaL_pushresult(&B);
+	lua_pop(b->L, 1);
+}
+
+static void bench_memcpy (Bench *b) {
+	memcpy(b->dst, b->src, b->size);
+}
+
+static void bench_checkarray (Bench *b) {
+	size_t len;
+	luamem_checkarray(b->L, 1, &len);
+}
+
+static void bench_packlayout (Bench *b) {
+	size_t pos = 0;
+	int arg = 3;  /* values after memory and layout */
+	luamem_packlayout(b->L, b->layout, b->dst, b->size, &pos, &arg);
+}
+
+static void bench_unpacklayout (Bench *b) {
+	size_t pos = 0;
+	int n = luamem_unpacklayout(b->L, b->layout, b->dst, b->size, &pos);
+	lua_pop(b->L, n);
+}
+
+
+int main (int argc, char *argv[]) {
+	size_t maxsize = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 1<<30;
+	Bench b;
+	json = (argc > 1 && strcmp(argv[1], "json") == 0);
+	if (argc > 3) mintime = strtod(argv[3], NULL);
+	b.L = luaL_newstate();
+	header();
+	for (b.size = 16; b.size <= maxsize; b.size *= 4) {
+		b.src = (char *)malloc(b.size);
+		b.dst = (char *)malloc(b.size);
+		if (b.src == NULL || b.dst == NULL) {
+			fprintf(stderr, "cbench: not enough memory\n");
+			return EXIT_FAILURE;
+		}
+		memset(b.src, 'x', b.size);
+		memset(b.dst, 0, b.size);
+		lua_settop(b.L, 0);
+		memcpy(luamem_newalloc(b.L, b.size), b.src, b.size);
+		report("newalloc", "C API", &b, bench_newalloc);
+		report("newalloc", "libc", &b, bench_malloc);
+		report("addvalue", "C API", &b, bench_addvalue);
+		report("addvalue", "libc", &b, bench_memcpy);
+		report("buffer", "C API", &b, bench_buffer);
+		report("buffer", "lauxlib", &b, bench_luabuffer);
+		free(b.src);
+		free(b.dst);
+	}
+	b.size = 16;
+	b.dst = (char *)calloc(b.size, 1);
+	lua_settop(b.L, 0);
+	luamem_newalloc(b.L, b.size);
+	report("checkarray", "C API", &b, bench_checkarray);
+	b.layout = luamem_newlayout(b.L, "<i4i4d");
+	lua_pushinteger(b.L, 1);
+	lua_pushinteger(b.L, 2);
+	lua_pushnumber(b.L, 3.0);
+	report("packlayout", "C API", &b, bench_packlayout);
+	report("unpacklayout", "C API", &b, bench_unpacklayout);
+	free(b.dst);
+	footer();
+	lua_close(b.L);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,55 @@
+-- Measures the time per call of short functions of module 'memory', which
+-- are dominated by the check of the type of their arguments. Run it with
+-- builds of the module before and after a change to compare them:
+--
+--   LUA_CPATH="old/src/?.so" lua bench/typecheck.lua
+--   LUA_CPATH="new/src/?.so" lua bench/typecheck.lua
+
+local memory = require "memory"
+
+local rounds = tonumber(arg and arg[1]) or 1e7
+
+local function measure(name, f, ...)
+	local start = os.clock()
+	f(rounds, ...)
+	local elapsed = os.clock()-start
+	print(string.format("%-24s %8.2f ns/call", name, elapsed*1e9/rounds))
+end
+
+local function callget(n, m)
+	local get = memory.get
+	for i = 1, n do get(m, 1) end
+end
+
+local function callset(n, m)
+	local set = memory.set
+	for i = 1, n do set(m, 1, 255) end
+end
+
+local function calllen(n, m)
+	local len = memory.len
+	for i = 1, n do len(m) end
+end
+
+local function calltype(n, v)
+	local type = memory.type
+	for i = 1, n do type(v) end
+end
+
+local function callrawequal(n, m)
+	local rawequal = rawequal
+	for i = 1, n do rawequal(m, m) end
+end
+
+local fixed = memory.create(16)
+local resizable = memory.create()
+memory.resize(resizable, 16)
+
+measure("rawequal(fixed)", callrawequal, fixed)
+measure("memory.type(file)", calltype, io.stdout)
+for _, case in ipairs{ { "fixed", fixed }, { "resizable", resizable } } do
+	local name, m = table.unpack(case)
+	measure("memory.len("..name..")", calllen, m)
+	measure("memory.get("..name..")", callget, m)
+	measure("memory.set("..name..")", callset, m)
+end
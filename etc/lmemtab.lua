@@ -0,0 +1,80 @@
+-- Generates 'src/lmemtab.h' with the constant tables of 'src/lmemlib.c',
+-- so they are never computed while several threads might read them.
+--
+-- Usage: lua etc/lmemtab.lua > src/lmemtab.h
+
+local out = {}
+
+local function write(...)
+	for i = 1, select("#", ...) do out[#out+1] = select(i, ...) end
+end
+
+local function writerows(values, perline, format)
+	for i = 1, #values, perline do
+		local line = {}
+		for k = i, math.min(i+perline-1, #values) do
+			line[#line+1] = string.format(format, values[k])
+		end
+		write("\t\t", table.concat(line, ", "), i+perline <= #values and ",\n" or "\n")
+	end
+end
+
+-- slicing-by-8 tables of the CRC with reflected polynomial 'poly'
+local function crctables(name, poly)
+	local tab = { {} }
+	for i = 0, 255 do
+		local c = i
+		for _ = 1, 8 do c = (c & 1 == 1) and (c >> 1) ~ poly or c >> 1 end
+		tab[1][i+1] = c
+	end
+	for k = 2, 8 do
+		tab[k] = {}
+		for i = 1, 256 do
+			local c = tab[k-1][i]
+			tab[k][i] = (c >> 8) ~ tab[1][(c & 0xff)+1]
+		end
+	end
+	write("static const uint32_t ", name, "[8][256] = {\n")
+	for k = 1, 8 do
+		write("\t{\n")
+		writerows(tab[k], 6, "0x%08xu")
+		write(k < 8 and "\t},\n" or "\t}\n")
+	end
+	write("};\n\n")
+end
+
+-- values of digits (-1 if invalid) of codecs hex, base64 and base64url
+local function digitvalues()
+	local alphabets = {
+		"0123456789abcdef",
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/",
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_",
+	}
+	write("static const signed char digitvalues[3][UCHAR_MAX+1] = {\n")
+	for c, digits in ipairs(alphabets) do
+		local values = {}
+		for i = 1, 256 do values[i] = -1 end
+		for i = 1, #digits do
+			values[digits:byte(i)+1] = i-1
+			if c == 1 then values[digits:upper():byte(i)+1] = i-1 end
+		end
+		write("\t{\n")
+		writerows(values, 16, "%2d")
+		write(c < #alphabets and "\t},\n" or "\t}\n")
+	end
+	write("};\n\n")
+end
+
+write([[
+/*
+** Constant tables of 'lmemlib.c', generated by 'etc/lmemtab.lua'.
+** Do not edit.
+*/
+
+]])
+crctables("crc32tab", 0xedb88320)
+crctables("crc32ctab", 0x82f63b78)
+digitvalues()
+out[#out] = out[#out]:sub(1, -2)  -- single newline at the end
+
+io.write(table.concat(out))
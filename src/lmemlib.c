@@ -3,15 +3,128 @@
 
 #include "luamem.h"
 
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <lualib.h>
 
+#include "lmemtab.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+** CRC-32C is computed by SSE4.2 instructions when the compiler targets
+** them, or else when the processor supports them, which is checked on
+** each call.
+*/
+#if defined(__SSE4_2__)
+#define CRC32CHW	/* always available */
+#define hascrc32chw()	1
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32CHW	__attribute__((target("sse4.2")))
+#define hascrc32chw()	__builtin_cpu_supports("sse4.2")
+#endif
+#if defined(CRC32CHW)
+#include <nmmintrin.h>
+#endif
+
+#if defined(LUA_USE_POSIX)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+    !defined(__STDC_NO_ATOMICS__)
+#define ATOMICSUPPORT
+#include <stdatomic.h>
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define SIMDWIDTH	32
+typedef __m256i SimdVec;
+#define simdload(p)	_mm256_loadu_si256((const __m256i *)(p))
+#define simdset(c)	_mm256_set1_epi8(c)
+#define simdmatch(p,v)	_mm256_cmpeq_epi8(simdload(p), v)
+#define simdmask(a,b)	((unsigned int)_mm256_movemask_epi8(_mm256_and_si256(a, b)))
+#define simdequal(p,q)	((unsigned int)_mm256_movemask_epi8(simdmatch(p, simdload(q))))
+#define simdstore(p,v)	_mm256_storeu_si256((__m256i *)(p), v)
+#define simdand(a,b)	_mm256_and_si256(a, b)
+#define simdor(a,b)	_mm256_or_si256(a, b)
+#define simdxor(a,b)	_mm256_xor_si256(a, b)
+#define simdeq(a,b)	_mm256_cmpeq_epi8(a, b)
+#define simdbits(a)	((unsigned int)_mm256_movemask_epi8(a))
+#define SIMDALLEQUAL	0xffffffffu
+#define SIMDSHUFFLE
+#define simdtable(p)	_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(p)))
+#define simdshuffle(t,i)	_mm256_shuffle_epi8(t, i)
+#define simdnibble(a)	_mm256_and_si256(_mm256_srli_epi16(a, 4), _mm256_set1_epi8(0x0f))
+#elif defined(__SSE2__)
+#define SIMDWIDTH	16
+typedef __m128i SimdVec;
+#define simdload(p)	_mm_loadu_si128((const __m128i *)(p))
+#define simdset(c)	_mm_set1_epi8(c)
+#define simdmatch(p,v)	_mm_cmpeq_epi8(simdload(p), v)
+#define simdmask(a,b)	((unsigned int)_mm_movemask_epi8(_mm_and_si128(a, b)))
+#define simdequal(p,q)	((unsigned int)_mm_movemask_epi8(simdmatch(p, simdload(q))))
+#define simdstore(p,v)	_mm_storeu_si128((__m128i *)(p), v)
+#define simdand(a,b)	_mm_and_si128(a, b)
+#define simdor(a,b)	_mm_or_si128(a, b)
+#define simdxor(a,b)	_mm_xor_si128(a, b)
+#define simdeq(a,b)	_mm_cmpeq_epi8(a, b)
+#define simdbits(a)	((unsigned int)_mm_movemask_epi8(a))
+#define SIMDALLEQUAL	0xffffu
+#if defined(__SSSE3__)
+#define SIMDSHUFFLE
+#define simdtable(p)	_mm_loadu_si128((const __m128i *)(p))
+#define simdshuffle(t,i)	_mm_shuffle_epi8(t, i)
+#define simdnibble(a)	_mm_and_si128(_mm_srli_epi16(a, 4), _mm_set1_epi8(0x0f))
+#endif
+#endif
+
+#if defined(SIMDWIDTH)
+/* positions of the lowest and the highest bits set in a non-zero mask */
+#if defined(_MSC_VER)
+#include <intrin.h>
+static int lowbit (unsigned int mask) {
+	unsigned long k;
+	_BitScanForward(&k, mask);
+	return (int)k;
+}
+static int highbit (unsigned int mask) {
+	unsigned long k;
+	_BitScanReverse(&k, mask);
+	return (int)k;
+}
+#else
+#define lowbit(m)	__builtin_ctz(m)
+#define highbit(m)	(31-__builtin_clz(m))
+#endif
+#endif
+
 static size_t posrelatI (lua_Integer pos, size_t len);
 static size_t getendpos (lua_State *L, int arg, lua_Integer def, size_t len);
 static int str2byte (lua_State *L, const char *s, size_t l);
 static void code2char (lua_State *L, int idx, char *p, size_t n);
+static int isreadonly (lua_State *L, int idx);
+static char *checkwritable (lua_State *L, int arg, size_t *len);
 static const char *lmemfind (const char *s1, size_t l1,
                              const char *s2, size_t l2);
+static int str_find_aux (lua_State *L, int find);
+static int gmatch (lua_State *L);
 
 static int mem_create (lua_State *L) {
 	if (lua_gettop(L) == 0) {
@@ -44,13 +157,51 @@ static int mem_create (lua_State *L) {
 	return 1;
 }
 
+/* filled bytes are copied after themselves in blocks up to this size */
+#define FILLCHUNK	16384
+
+/*
+** Fills 'size' bytes of 'mem' with copies of the 'len' bytes of 's'.
+** After the first copy of 's', the bytes already filled are copied after
+** themselves, doubling the filled part until it is 'FILLCHUNK' bytes
+** long, so its copies are read from the cache. Patterns with a period
+** that divides a vector are stored a whole vector at a time. When 's'
+** overlaps 'mem', every copy is read from 's', so it gets the bytes of
+** 's' changed by previous copies.
+*/
 static void memfill (char *mem, size_t size, const char *s, size_t len) {
-	do {
-		size_t n = size < len ? size : len;
-		memmove(mem, s, n*sizeof(char));
-		mem += n;
-		size -= n;
-	} while (size > 0);
+	size_t filled, block;
+	if (len == 1) {
+		memset(mem, *s, size*sizeof(char));
+		return;
+	}
+	if ((uintptr_t)s < (uintptr_t)(mem+size) &&
+	    (uintptr_t)mem < (uintptr_t)(s+len)) {  /* overlapping? */
+		do {
+			size_t n = size < len ? size : len;
+			memmove(mem, s, n*sizeof(char));
+			mem += n;
+			size -= n;
+		} while (size > 0);
+		return;
+	}
+	filled = block = (size < len ? size : len);
+	memmove(mem, s, filled*sizeof(char));
+	while (filled < size) {
+		size_t n = size-filled;
+#if defined(SIMDWIDTH)
+		if (filled == SIMDWIDTH && n >= SIMDWIDTH) {  /* period divides vector? */
+			const SimdVec v = simdload(mem);
+			for (; n >= SIMDWIDTH; n -= SIMDWIDTH, filled += SIMDWIDTH)
+				simdstore(mem+filled, v);
+			continue;
+		}
+#endif
+		if (n > block) n = block;
+		memcpy(mem+filled, mem, n*sizeof(char));
+		filled += n;
+		if (block < FILLCHUNK) block = filled;  /* double the copied block */
+	}
 }
 
 static int mem_resize (lua_State *L) {
@@ -62,18 +213,99 @@ static int mem_resize (lua_State *L) {
 	if (len != size) {
 		size_t sl, n = len < size ? size-len : 0;
 		const char *s = luamem_optarray(L, 3, NULL, &sl);
-		char *resized = (char *)luamem_realloc(L, mem, len, size);
-		if (size && !resized) return luaL_error(L, "out of memory");
-		luamem_resetref(L, 1, resized, size, luamem_free, 0 /* don't free 'mem' */);
+		mem = luamem_growref(L, 1, size);
 		if (n) {
-			resized += len;
-			if (sl) memfill(resized, n, s, sl);
-			else memset(resized, 0, n*sizeof(char));
+			mem += len;
+			if (sl) {
+				s = luamem_optarray(L, 3, NULL, NULL);  /* 's' might be moved */
+				memfill(mem, n, s, sl);
+			}
+			else memset(mem, 0, n*sizeof(char));
 		}
 	}
 	return 0;
 }
 
+static int mem_reserve (lua_State *L) {
+	luamem_Unref unref;
+	size_t cap;
+	luamem_tomemoryx(L, 1, NULL, &unref, NULL);
+	cap = luamem_checklenarg(L, 2);
+	luaL_argcheck(L, unref == luamem_free, 1, "resizable memory expected");
+	if (cap > luamem_capacity(L, 1)) luamem_reallocref(L, 1, cap);
+	return 0;
+}
+
+static int mem_shrink (lua_State *L) {
+	luamem_Unref unref;
+	luamem_tomemoryx(L, 1, NULL, &unref, NULL);
+	luaL_argcheck(L, unref == luamem_free, 1, "resizable memory expected");
+	luamem_reallocref(L, 1, 0);
+	return 0;
+}
+
+static int mem_capacity (lua_State *L) {
+	luamem_checkmemory(L, 1, NULL);
+	lua_pushinteger(L, (lua_Integer)luamem_capacity(L, 1));
+	return 1;
+}
+
+/*
+** Gets the range of positions from arguments 'iarg' until 'jarg' of an
+** array with 'len' bytes. Returns its offset and puts its size in 'n'.
+*/
+static size_t getrange (lua_State *L, int iarg, int jarg, size_t len,
+                        size_t *n) {
+	size_t posi = posrelatI(luaL_optinteger(L, iarg, 1), len);
+	size_t pose = getendpos(L, jarg, -1, len);
+	if (posi > pose) {
+		*n = 0;
+		return 0;
+	}
+	*n = (pose-posi)+1;
+	if (posi+*n <= pose)  /* arithmetic overflow? */
+		luaL_error(L, "string slice too long");
+	return posi-1;
+}
+
+static int mem_view (lua_State *L) {
+	size_t len, n, i;
+	luamem_checkmemory(L, 1, &len);
+	i = getrange(L, 2, 3, len, &n);
+	luamem_newview(L, 1, i, n);
+	return 1;
+}
+
+static int mem_ring (lua_State *L) {
+	size_t size = luamem_checklenarg(L, 1);
+	luaL_argcheck(L, size > 0, 1, "invalid size");
+	luamem_newring(L, size, lua_toboolean(L, 2));
+	return 1;
+}
+
+static int mem_produce (lua_State *L) {
+	size_t len, n, i, space;
+	char *p;
+	luamem_checkarray(L, 2, &len);
+	i = getrange(L, 3, 4, len, &n);
+	p = luamem_ringspace(L, 1, n, &space);
+	luaL_argcheck(L, p != NULL, 1, "ring expected");
+	if (n > space) n = space;
+	memcpy(p, luamem_toarray(L, 2, NULL)+i, n);  /* 's' may have moved */
+	lua_pushinteger(L, (lua_Integer)luamem_produce(L, 1, n));
+	return 1;
+}
+
+static int mem_consume (lua_State *L) {
+	size_t len;
+	luamem_tomemory(L, 1, &len);
+	luaL_argcheck(L, luamem_ringspace(L, 1, 0, NULL) != NULL, 1,
+	                 "ring expected");
+	if (!lua_isnoneornil(L, 2)) len = luamem_checklenarg(L, 2);
+	lua_pushinteger(L, (lua_Integer)luamem_consume(L, 1, len));
+	return 1;
+}
+
 static int mem_type (lua_State *L) {
 	luamem_Unref unref;
 	int type;
@@ -96,137 +328,2722 @@ static int mem_len (lua_State *L) {
 	return 1;
 }
 
+/*
+** Pushes a string with 'n' bytes from offset 'i' of the resizable memory
+** at index 1, which becomes empty. When Lua supports external strings,
+** the contents are handed over to the string without a copy.
+*/
+static void movetostring (lua_State *L, size_t i, size_t n) {
+	char *mem = luamem_tomemory(L, 1, NULL);
+	if (n == 0) lua_pushliteral(L, "");
+#if LUA_VERSION_NUM >= 505
+	else {
+		void *ud;
+		lua_Alloc allocf = lua_getallocf(L, &ud);
+		if (i > 0) memmove(mem, mem+i, n*sizeof(char));
+		luamem_growref(L, 1, n);  /* only changes the length */
+		mem = luamem_reallocref(L, 1, n+1);  /* exact size to be freed */
+		mem[n] = '\0';  /* external strings must be zero-terminated */
+		lua_pushexternalstring(L, mem, n, allocf, ud);
+		luamem_resetref(L, 1, NULL, 0, luamem_free, 0);  /* keep contents */
+		return;
+	}
+#else
+	else lua_pushlstring(L, mem+i, n);
+#endif
+	luamem_growref(L, 1, 0);
+	luamem_reallocref(L, 1, 0);
+}
+
 static int mem_tostring (lua_State *L) {
+	static const char *const modes[] = { "copy", "move", NULL };
 	size_t len;
 	const char *s = luamem_checkarray(L, 1, &len);
 	size_t start = posrelatI(luaL_optinteger(L, 2, 1), len);
 	size_t end = getendpos(L, 3, -1, len);
-	if (start <= end) lua_pushlstring(L, s+start-1, (end-start)+1);
+	if (luaL_checkoption(L, 4, "copy", modes)) {
+		luamem_Unref unref;
+		luamem_tomemoryx(L, 1, NULL, &unref, NULL);
+		luaL_argcheck(L, unref == luamem_free, 1, "resizable memory expected");
+		movetostring(L, start-1, start <= end ? (end-start)+1 : 0);
+	}
+	else if (start <= end) lua_pushlstring(L, s+start-1, (end-start)+1);
 	else lua_pushliteral(L, "");
 	return 1;
 }
 
-static int mem_diff (lua_State *L) {
-	size_t l1, l2;
-	const char *s1 = luamem_checkarray(L, 1, &l1);
-	const char *s2 = luamem_checkarray(L, 2, &l2);
-	size_t i, n=(l1<l2 ? l1 : l2);
-	for (i=0; (i<n) && (s1[i]==s2[i]); i++);
-	if (i<n) {
-		lua_pushinteger(L, i+1);
-		lua_pushboolean(L, s1[i]<s2[i]);
-	} else if (l1==l2) {
-		lua_pushnil(L);
-		lua_pushboolean(L, 0);
-	} else {
-		lua_pushinteger(L, i+1);
-		lua_pushboolean(L, l1<l2);
+static int mem_freeze (lua_State *L) {
+	size_t len;
+	luamem_Unref unref;
+	luamem_tomemoryx(L, 1, &len, &unref, NULL);
+	luaL_argcheck(L, unref == luamem_free, 1, "resizable memory expected");
+	movetostring(L, 0, len);
+	return 1;
+}
+
+/*
+** Returns the position of the first byte that differs in blocks 's1' and
+** 's2' of 'n' bytes, or 'n' if they are equal, comparing a whole vector
+** (or word) of bytes at a time.
+*/
+static size_t lmemdiff (const char *s1, const char *s2, size_t n) {
+	size_t i = 0;
+#if defined(SIMDWIDTH)
+	for (; i+SIMDWIDTH <= n; i += SIMDWIDTH) {
+		unsigned int mask = simdequal(s1+i, s2+i);
+		if (mask != SIMDALLEQUAL)
+			return i+(size_t)lowbit(~mask);
+	}
+#else
+	for (; i+sizeof(size_t) <= n; i += sizeof(size_t)) {
+		size_t w1, w2;
+		memcpy(&w1, s1+i, sizeof(size_t));
+		memcpy(&w2, s2+i, sizeof(size_t));
+		if (w1 != w2) break;
+	}
+#endif
+	while (i < n && s1[i] == s2[i]) i++;
+	return i;
+}
+
+/*
+** Compares blocks 's1' and 's2' of 'l1' and 'l2' bytes as sequences of
+** unsigned bytes, so a block is smaller than any longer block it prefixes.
+*/
+static int lmemcmp (const char *s1, size_t l1, const char *s2, size_t l2) {
+	int res = memcmp(s1, s2, l1 < l2 ? l1 : l2);
+	if (res != 0 || l1 == l2) return (res > 0) - (res < 0);
+	return l1 < l2 ? -1 : 1;
+}
+
+static int mem_diff (lua_State *L) {
+	size_t l1, l2;
+	const char *s1 = luamem_checkarray(L, 1, &l1);
+	const char *s2 = luamem_checkarray(L, 2, &l2);
+	size_t n = (l1<l2 ? l1 : l2);
+	size_t i = lmemdiff(s1, s2, n);
+	if (i<n) {
+		lua_pushinteger(L, i+1);
+		lua_pushboolean(L, s1[i]<s2[i]);
+	} else if (l1==l2) {
+		lua_pushnil(L);
+		lua_pushboolean(L, 0);
+	} else {
+		lua_pushinteger(L, i+1);
+		lua_pushboolean(L, l1<l2);
+	}
+	return 2;
+}
+
+static int mem_compare (lua_State *L) {
+	size_t l1, l2, n1, n2, i1, i2;
+	const char *s1 = luamem_checkarray(L, 1, &l1);
+	const char *s2 = luamem_checkarray(L, 2, &l2);
+	i1 = getrange(L, 3, 4, l1, &n1);
+	i2 = getrange(L, 5, 6, l2, &n2);
+	lua_pushinteger(L, lmemcmp(s1+i1, n1, s2+i2, n2));
+	return 1;
+}
+
+static int mem_eq (lua_State *L) {
+	size_t l1, l2;
+	const char *s1 = luamem_checkarray(L, 1, &l1);
+	const char *s2 = luamem_checkarray(L, 2, &l2);
+	lua_pushboolean(L, l1 == l2 && (s1 == s2 || memcmp(s1, s2, l1) == 0));
+	return 1;
+}
+
+static int mem_lt (lua_State *L) {
+	size_t l1, l2;
+	const char *s1 = luamem_checkarray(L, 1, &l1);
+	const char *s2 = luamem_checkarray(L, 2, &l2);
+	lua_pushboolean(L, lmemcmp(s1, l1, s2, l2) < 0);
+	return 1;
+}
+
+static int mem_le (lua_State *L) {
+	size_t l1, l2;
+	const char *s1 = luamem_checkarray(L, 1, &l1);
+	const char *s2 = luamem_checkarray(L, 2, &l2);
+	lua_pushboolean(L, lmemcmp(s1, l1, s2, l2) <= 0);
+	return 1;
+}
+
+static int mem_get (lua_State *L) {
+	size_t len;
+	const char *s = luamem_checkmemory(L, 1, &len);
+	return str2byte(L, s, len);
+}
+
+static int mem_set (lua_State *L) {
+	size_t len;
+	size_t n = lua_gettop(L)-2;  /* number of bytes */
+	char *p = checkwritable(L, 1, &len);
+	size_t i = posrelatI(luaL_checkinteger(L, 2), len);
+	luaL_argcheck(L, 1 <= i && i <= len, 2, "index out of bounds");
+	len = 1+len-i;
+	code2char(L, 3, p+i-1, n < len ? n : len);
+	return 0;
+}
+
+static int mem_totable (lua_State *L) {
+	size_t len, n, i, k;
+	const char *s = luamem_checkmemory(L, 1, &len);
+	lua_Integer ti = luaL_optinteger(L, 5, 1);
+	i = getrange(L, 2, 3, len, &n);
+	luaL_argcheck(L, n == 0 || ti <= LUA_MAXINTEGER - (lua_Integer)(n-1), 5,
+	                 "too many elements");
+	if (lua_isnoneornil(L, 4)) {
+		luaL_argcheck(L, n < (size_t)INT_MAX, 3, "too many elements");
+		lua_createtable(L, ti == 1 ? (int)n : 0, 0);
+	}
+	else {
+		luaL_checktype(L, 4, LUA_TTABLE);
+		lua_settop(L, 4);
+	}
+	for (k = 0; k < n; k++) {
+		lua_pushinteger(L, (unsigned char)s[i+k]);
+		lua_rawseti(L, -2, ti+(lua_Integer)k);
+	}
+	return 1;
+}
+
+static int mem_fromtable (lua_State *L) {
+	size_t len, n, k;
+	char *p = checkwritable(L, 1, &len);
+	size_t i = posrelatI(luaL_checkinteger(L, 2), len);
+	lua_Integer ti, tj;
+	luaL_checktype(L, 3, LUA_TTABLE);
+	ti = luaL_optinteger(L, 4, 1);
+	tj = luaL_opt(L, luaL_checkinteger, 5, (lua_Integer)lua_rawlen(L, 3));
+	luaL_argcheck(L, 1 <= i && i <= len, 2, "index out of bounds");
+	if (ti > tj) return 0;  /* empty interval */
+	len = 1+len-i;
+	n = ((lua_Unsigned)tj - (lua_Unsigned)ti < (lua_Unsigned)len) ?
+	    (size_t)((lua_Unsigned)tj - (lua_Unsigned)ti)+1 : len;
+	for (k = 0; k < n; k++) {
+		int isint;
+		lua_Integer c;
+		lua_rawgeti(L, 3, ti+(lua_Integer)k);
+		c = lua_tointegerx(L, -1, &isint);
+		if (l_unlikely(!isint || (lua_Unsigned)c > UCHAR_MAX))
+			return luaL_error(L, "invalid value (at index %I) in table",
+			                  (LUAI_UACINT)(ti+(lua_Integer)k));
+		p[i-1+k] = (char)c;
+		lua_pop(L, 1);
+	}
+	return 0;
+}
+
+/*
+** Returns the bytes from the position at argument 'oarg' of the memory or
+** string at argument 'arg', or the byte code at this argument stored in
+** 'c', or NULL if there are no such bytes.
+*/
+static const char *checkpattern (lua_State *L, int arg, int oarg, char *c,
+                                 size_t *len) {
+	size_t sl, os;
+	const char *s;
+	if (lua_type(L, arg) == LUA_TNUMBER) {
+		code2char(L, arg, c, 1);
+		*len = 1;
+		return c;
+	}
+	s = luamem_checkarray(L, arg, &sl);
+	os = posrelatI(luaL_optinteger(L, oarg, 1), sl);
+	if (os > sl) return NULL;
+	*len = sl-os+1;
+	return s+os-1;
+}
+
+static int mem_fill (lua_State *L) {
+	size_t len, sl;
+	char *p = checkwritable(L, 1, &len);
+	size_t i = posrelatI(luaL_optinteger(L, 3, 1), len);
+	size_t j = getendpos(L, 4, -1, len);
+	char c;
+	const char *s = checkpattern(L, 2, 5, &c, &sl);
+	if (i <= j && s) memfill(p+i-1, j-i+1, s, sl);
+	return 0;
+}
+
+static int mem_rep (lua_State *L) {
+	size_t sl, total = 0;
+	const char *s = luamem_checkarray(L, 1, &sl);
+	lua_Integer n = luaL_checkinteger(L, 2);
+	char *p;
+	if (n > 0 && sl > 0) {
+		if (l_unlikely((lua_Unsigned)n > LUAMEM_MAXSIZE / sl))
+			return luaL_error(L, "resulting memory too large");
+		total = sl * (size_t)n;
+	}
+	p = luamem_newalloc(L, total);
+	if (total > 0) memfill(p, total, s, sl);
+	return 1;
+}
+
+/* repeating keys shorter than this are copied to fill a block this size */
+#define BITKEYSIZE	256
+
+#define BITAND	0
+#define BITOR	1
+#define BITXOR	2
+
+#if defined(SIMDWIDTH)
+#define bitwords(OP,VOP)  \
+	for (; k+SIMDWIDTH <= n; k += SIMDWIDTH)  \
+		simdstore(d+k, VOP(simdload(d+k), simdload(s+k)));
+#else
+#define bitwords(OP,VOP)  \
+	for (; k+sizeof(size_t) <= n; k += sizeof(size_t)) {  \
+		size_t a, b;  \
+		memcpy(&a, d+k, sizeof(size_t));  \
+		memcpy(&b, s+k, sizeof(size_t));  \
+		a = a OP b;  \
+		memcpy(d+k, &a, sizeof(size_t));  \
+	}
+#endif
+
+#define bitloop(OP,VOP) {  \
+	size_t k = 0;  \
+	bitwords(OP, VOP)  \
+	for (; k < n; k++) d[k] = (char)(d[k] OP s[k]); }
+
+static void bitblock (char *d, const char *s, size_t n, int op) {
+	switch (op) {
+		case BITAND: bitloop(&, simdand); break;
+		case BITOR: bitloop(|, simdor); break;
+		default: bitloop(^, simdxor); break;
+	}
+}
+
+/*
+** Combines 'size' bytes of 'mem' with bytes of 's' using the bitwise
+** operation 'op', repeating the 'len' bytes of 's' as needed. Short keys
+** are first repeated to fill a block, so they are combined a whole vector
+** at a time as well.
+*/
+static void membitop (char *mem, size_t size, const char *s, size_t len,
+                      int op) {
+	char key[BITKEYSIZE];
+	if (len < size && len < BITKEYSIZE) {
+		size_t n = (BITKEYSIZE/len)*len;  /* whole copies of 's' */
+		memfill(key, n, s, len);
+		s = key;
+		len = n;
+	}
+	while (size > 0) {
+		size_t n = size < len ? size : len;
+		bitblock(mem, s, n, op);
+		mem += n;
+		size -= n;
+	}
+}
+
+static int bitop (lua_State *L, int op) {
+	size_t len, sl;
+	char *p = checkwritable(L, 1, &len);
+	size_t i = posrelatI(luaL_optinteger(L, 3, 1), len);
+	size_t j = getendpos(L, 4, -1, len);
+	char c;
+	const char *s = checkpattern(L, 2, 5, &c, &sl);
+	if (i <= j && s) membitop(p+i-1, j-i+1, s, sl, op);
+	return 0;
+}
+
+static int mem_band (lua_State *L) {
+	return bitop(L, BITAND);
+}
+
+static int mem_bor (lua_State *L) {
+	return bitop(L, BITOR);
+}
+
+static int mem_bxor (lua_State *L) {
+	return bitop(L, BITXOR);
+}
+
+static int mem_bnot (lua_State *L) {
+	size_t len;
+	char *p = checkwritable(L, 1, &len);
+	size_t i = posrelatI(luaL_optinteger(L, 2, 1), len);
+	size_t j = getendpos(L, 3, -1, len);
+	if (i <= j) membitop(p+i-1, j-i+1, "\xff", 1, BITXOR);
+	return 0;
+}
+
+static int mem_concat (lua_State *L) {
+	size_t l1, l2;
+	const char *s1 = luamem_toarray(L, 1, &l1);
+	const char *s2 = luamem_toarray(L, 2, &l2);
+	if (s1 && s2) {
+		luaL_Buffer B;
+		char *buff = luaL_buffinitsize(L, &B, l1+l2);
+		memcpy(buff, s1, l1*sizeof(char));
+		memcpy(buff+l1, s2, l2*sizeof(char));
+		luaL_addsize(&B, l1+l2);
+		luaL_pushresult(&B);
+	} else {
+		if (l_unlikely(luamem_ismemory(L, 2) ||
+			             !luaL_getmetafield(L, 2, "__concat")))
+			luaL_error(L, "attempt to concat a '%s' with a '%s'",
+			              luaL_typename(L, 1), luaL_typename(L, 2));
+		lua_insert(L, -3);  /* put metamethod before arguments */
+		lua_call(L, 2, 1);  /* call metamethod */
+	}
+	return 1;
+}
+
+/*
+** {======================================================
+** SEARCH
+** =======================================================
+*/
+
+#define SEARCHER	"luamem_Searcher"
+
+/* needles at least this long are searched using the Two-Way algorithm */
+#define TWOWAYMINLEN	32
+
+typedef struct Searcher {
+	const char *needle;
+	size_t len;  /* length of 'needle' */
+	size_t crit;  /* critical factorization position (Two-Way only) */
+	size_t period;  /* shift after a full match attempt (Two-Way only) */
+	size_t memory;  /* prefix known to match after shifting by 'period' */
+	size_t shift[UCHAR_MAX+1];  /* last position+1 of each byte in 'needle' */
+} Searcher;
+
+/*
+** Computes the maximal suffix of 'n' for the ordering given by 'rev',
+** returning its position minus one and the period in 'period'.
+*/
+static size_t maxsuffix (const unsigned char *n, size_t l, int rev,
+                         size_t *period) {
+	size_t ip = (size_t)-1, jp = 0, k = 1, p = 1;
+	while (jp+k < l) {
+		unsigned char a = n[ip+k], b = n[jp+k];
+		if (a == b) {
+			if (k == p) {
+				jp += p;
+				k = 1;
+			}
+			else k++;
+		}
+		else if (rev ? a < b : a > b) {
+			jp += k;
+			k = 1;
+			p = jp-ip;
+		}
+		else {
+			ip = jp++;
+			k = p = 1;
+		}
+	}
+	*period = p;
+	return ip;
+}
+
+static void initsearcher (Searcher *S, const char *needle, size_t l) {
+	S->needle = needle;
+	S->len = l;
+	if (l >= TWOWAYMINLEN) {
+		const unsigned char *n = (const unsigned char *)needle;
+		size_t i, p, rp;
+		size_t ms = maxsuffix(n, l, 0, &p);
+		size_t rms = maxsuffix(n, l, 1, &rp);
+		if (rms+1 > ms+1) {
+			ms = rms;
+			p = rp;
+		}
+		if (memcmp(n, n+p, ms+1) != 0) {  /* needle is not periodic? */
+			S->memory = 0;
+			p = (ms > l-ms-1 ? ms : l-ms-1)+1;
+		}
+		else S->memory = l-p;
+		S->crit = ms;
+		S->period = p;
+		memset(S->shift, 0, sizeof(S->shift));
+		for (i = 0; i < l; i++) S->shift[n[i]] = i+1;
+	}
+}
+
+/*
+** Two-Way string matching (Crochemore & Perrin), with a bad-character
+** shift on the last byte of each window. It runs in linear time even
+** for highly repetitive contents, where 'lmemfind' degenerates.
+*/
+static const char *twowayfind (const Searcher *S, const char *s, size_t sl) {
+	const unsigned char *h = (const unsigned char *)s;
+	const unsigned char *z = h+sl;
+	const unsigned char *n = (const unsigned char *)S->needle;
+	size_t l = S->len, ms = S->crit, mem = 0, k;
+	while ((size_t)(z-h) >= l) {
+		k = l-S->shift[h[l-1]];
+		if (k > 0) {  /* last byte does not match? */
+			h += k;
+			mem = 0;
+			continue;
+		}
+		for (k = (ms+1 > mem ? ms+1 : mem); k < l && n[k] == h[k]; k++);
+		if (k < l) {  /* right half does not match? */
+			h += k-ms;
+			mem = 0;
+			continue;
+		}
+		for (k = ms+1; k > mem && n[k-1] == h[k-1]; k--);
+		if (k <= mem) return (const char *)h;
+		h += S->period;
+		mem = S->memory;
+	}
+	return NULL;
+}
+
+static const char *lmemrfind (const char *s1, size_t l1,
+                              const char *s2, size_t l2) {
+	if (l2 <= l1) {
+		size_t i = l1-l2+1;
+		while (i-- > 0)
+			if (s1[i] == *s2 && memcmp(s1+i+1, s2+1, l2-1) == 0)
+				return s1+i;
+	}
+	return NULL;
+}
+
+#if defined(SIMDWIDTH)
+/*
+** Compares the first and last bytes of the needle with a whole vector of
+** candidate positions at once, and only checks the remaining bytes of
+** the positions where both match.
+*/
+static const char *simdfind (const char *s1, size_t l1,
+                             const char *s2, size_t l2) {
+	const SimdVec first = simdset(s2[0]);
+	const SimdVec last = simdset(s2[l2-1]);
+	size_t i, e = l1-l2;  /* last position the needle fits */
+	for (i = 0; i+SIMDWIDTH-1 <= e; i += SIMDWIDTH) {
+		unsigned int mask = simdmask(simdmatch(s1+i, first),
+		                             simdmatch(s1+i+l2-1, last));
+		while (mask) {
+			size_t k = i+(size_t)lowbit(mask);
+			if (memcmp(s1+k+1, s2+1, l2-2) == 0) return s1+k;
+			mask &= mask-1;  /* clear lowest bit */
+		}
+	}
+	return lmemfind(s1+i, l1-i, s2, l2);
+}
+
+static const char *simdrfind (const char *s1, size_t l1,
+                              const char *s2, size_t l2) {
+	const SimdVec first = simdset(s2[0]);
+	const SimdVec last = simdset(s2[l2-1]);
+	size_t e = l1-l2+1;  /* number of positions the needle fits */
+	while (e >= SIMDWIDTH) {
+		unsigned int mask;
+		e -= SIMDWIDTH;
+		mask = simdmask(simdmatch(s1+e, first), simdmatch(s1+e+l2-1, last));
+		while (mask) {
+			unsigned int k = (unsigned int)highbit(mask);
+			if (memcmp(s1+e+k+1, s2+1, l2-2) == 0) return s1+e+k;
+			mask &= ~(1u<<k);  /* clear highest bit */
+		}
+	}
+	return lmemrfind(s1, e+l2-1, s2, l2);
+}
+#endif
+
+static const char *searchfwd (const Searcher *S, const char *s, size_t l) {
+	if (S->len > l) return NULL;
+	else if (S->len == 1) return (const char *)memchr(s, *S->needle, l);
+	else if (S->len >= TWOWAYMINLEN) return twowayfind(S, s, l);
+#if defined(SIMDWIDTH)
+	return simdfind(s, l, S->needle, S->len);
+#else
+	return lmemfind(s, l, S->needle, S->len);
+#endif
+}
+
+static const char *searchbwd (const Searcher *S, const char *s, size_t l) {
+	if (S->len > l) return NULL;
+#if defined(SIMDWIDTH)
+	else if (S->len > 1) return simdrfind(s, l, S->needle, S->len);
+#endif
+	return lmemrfind(s, l, S->needle, S->len);
+}
+
+/*
+** Gets the arguments of a search for the needle at 'sarg' (a string,
+** memory or searcher) in the memory or string at 'marg' from index 3
+** until index 4. Returns NULL if there is nothing to be found, or a
+** searcher of an empty needle, which is found at any position.
+*/
+static const Searcher *searchargs (lua_State *L, int marg, int sarg,
+                                   Searcher *buf, const char **p,
+                                   size_t *i, size_t *n) {
+	size_t len, j;
+	const Searcher *S = (const Searcher *)luaL_testudata(L, sarg, SEARCHER);
+	const char *s = NULL;
+	size_t sl = 0, os = 1;
+	if (S == NULL) {
+		s = luamem_checkarray(L, sarg, &sl);
+		os = posrelatI(luaL_optinteger(L, 5, 1), sl);
+	}
+	*p = luamem_checkarray(L, marg, &len);
+	*i = posrelatI(luaL_optinteger(L, 3, 1), len);
+	j = getendpos(L, 4, -1, len);
+	if (*i > j) return NULL;
+	*n = j-*i+1;
+	if (*i+*n <= j)  /* arithmetic overflow? */
+		luaL_error(L, "string slice too long");
+	(*i)--;
+	if (S == NULL) {
+		if (os > sl) {  /* no contents? */
+			if (sl > 0) return NULL;
+			os = 1;  /* empty needle */
+		}
+		os--;
+		sl -= os;
+		initsearcher(buf, s+os, sl < *n ? sl : *n);
+		S = buf;
+	}
+	return S;
+}
+
+static int pushfound (lua_State *L, size_t pos, size_t len) {
+	lua_pushinteger(L, (lua_Integer)pos+1);
+	lua_pushinteger(L, (lua_Integer)(pos+len));
+	return 2;
+}
+
+static int findwith (lua_State *L, int marg, int sarg, int reverse) {
+	Searcher buf;
+	const char *p, *found;
+	size_t i, n;
+	const Searcher *S = searchargs(L, marg, sarg, &buf, &p, &i, &n);
+	if (S == NULL) return 0;
+	if (S->len == 0)  /* empty needle? */
+		return pushfound(L, reverse ? i+n : i, 0);  /* like 'string.find' */
+	found = reverse ? searchbwd(S, p+i, n) : searchfwd(S, p+i, n);
+	return found ? pushfound(L, found-p, S->len) : 0;
+}
+
+static Searcher *newsearcher (lua_State *L, const char *s, size_t l) {
+	Searcher *S = (Searcher *)lua_newuserdatauv(L, sizeof(Searcher)+l, 0);
+	char *needle = (char *)(S+1);
+	memcpy(needle, s, l*sizeof(char));
+	initsearcher(S, needle, l);
+	luaL_setmetatable(L, SEARCHER);
+	return S;
+}
+
+static int findnext (lua_State *L) {
+	size_t len;
+	const char *p = luamem_toarray(L, lua_upvalueindex(1), &len);
+	const Searcher *S = (const Searcher *)lua_touserdata(L, lua_upvalueindex(2));
+	size_t i = (size_t)lua_tointeger(L, lua_upvalueindex(3));
+	size_t e = (size_t)lua_tointeger(L, lua_upvalueindex(4));
+	if (e > len) e = len;  /* memory was resized */
+	if (p && i < e) {
+		const char *found = searchfwd(S, p+i, e-i);
+		if (found) {
+			i = found-p;
+			lua_pushinteger(L, (lua_Integer)(i+S->len));
+			lua_replace(L, lua_upvalueindex(3));
+			return pushfound(L, i, S->len);
+		}
+		lua_pushinteger(L, (lua_Integer)e);  /* no more occurrences */
+		lua_replace(L, lua_upvalueindex(3));
+	}
+	return 0;
+}
+
+static int findallwith (lua_State *L, int marg, int sarg) {
+	Searcher buf;
+	const char *p;
+	size_t i = 0, n = 0;
+	const Searcher *S = searchargs(L, marg, sarg, &buf, &p, &i, &n);
+	if (S != NULL && S->len == 0) S = NULL;  /* no occurrences to iterate */
+	lua_pushvalue(L, marg);
+	if (S == NULL) lua_pushnil(L);  /* nothing to be found */
+	else if (S == &buf) newsearcher(L, S->needle, S->len);
+	else lua_pushvalue(L, sarg);
+	lua_pushinteger(L, (lua_Integer)i);
+	lua_pushinteger(L, (lua_Integer)(S ? i+n : 0));
+	lua_pushcclosure(L, findnext, 4);
+	return 1;
+}
+
+static int splitnext (lua_State *L) {
+	size_t len, e, end;
+	const char *p = luamem_toarray(L, lua_upvalueindex(1), &len);
+	const Searcher *S = (const Searcher *)lua_touserdata(L, lua_upvalueindex(2));
+	lua_Integer i = lua_tointeger(L, lua_upvalueindex(3));
+	const char *found = NULL;
+	if (i < 0) return 0;  /* no more fields */
+	e = (size_t)lua_tointeger(L, lua_upvalueindex(4));
+	if (e > len) e = len;  /* memory was resized */
+	if (p && (size_t)i < e) found = searchfwd(S, p+i, e-(size_t)i);
+	if (found) {
+		end = found-p;
+		lua_pushinteger(L, (lua_Integer)(end+S->len));
+	}
+	else {
+		end = (size_t)i < e ? e : (size_t)i;  /* last field */
+		lua_pushinteger(L, -1);  /* no more fields */
+	}
+	lua_replace(L, lua_upvalueindex(3));
+	return pushfound(L, (size_t)i, end-(size_t)i);
+}
+
+/* sets with up to this number of bytes are matched by comparisons */
+#define FEWBYTES	3
+
+/*
+** A set of bytes, with tables of bits for each low nibble of the bytes,
+** where bit 'h' is set if the byte with high nibble 'h' (or 'h+8') is in
+** the set, so vectors of bytes are tested using shuffles.
+*/
+typedef struct ByteSet {
+	uint32_t bits[(UCHAR_MAX+1)/32];
+	size_t n;  /* number of distinct bytes */
+	unsigned char bytes[FEWBYTES];  /* first bytes added */
+	unsigned char lo[16];  /* bytes with high nibble 0-7 */
+	unsigned char hi[16];  /* bytes with high nibble 8-15 */
+} ByteSet;
+
+#define inbyteset(B,c)	(((B)->bits[(c) >> 5] >> ((c) & 31)) & 1)
+
+static void initbyteset (ByteSet *B, const char *s, size_t l) {
+	memset(B, 0, sizeof(ByteSet));
+	for (; l > 0; l--, s++) {
+		unsigned char c = (unsigned char)*s;
+		if (!inbyteset(B, c)) {
+			B->bits[c >> 5] |= (uint32_t)1 << (c & 31);
+			if (B->n < FEWBYTES) B->bytes[B->n] = c;
+			B->n++;
+			if (c < 0x80) B->lo[c & 0x0f] |= (unsigned char)(1 << (c >> 4));
+			else B->hi[c & 0x0f] |= (unsigned char)(1 << ((c >> 4) - 8));
+		}
+	}
+}
+
+#if defined(SIMDSHUFFLE)
+/* bit of each high nibble in tables 'lo' and 'hi' of 'ByteSet' */
+static const unsigned char nibblebits[2][16] = {
+	{ 1, 2, 4, 8, 16, 32, 64, 128, 0, 0, 0, 0, 0, 0, 0, 0 },
+	{ 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16, 32, 64, 128 }
+};
+#endif
+
+/*
+** Returns the position of the first byte of 's' that is in set 'B' if
+** 'in' is 1, or that is not in set 'B' if 'in' is 0, or 'l' if there is
+** no such byte.
+*/
+static size_t scanbytes (const ByteSet *B, const char *s, size_t l,
+                         int in) {
+	size_t i = 0;
+#if defined(SIMDWIDTH)
+	const unsigned int flip = in ? 0 : SIMDALLEQUAL;
+	if (B->n <= FEWBYTES) {
+		const SimdVec b0 = simdset((char)B->bytes[0]);
+		const SimdVec b1 = simdset((char)B->bytes[B->n > 1 ? 1 : 0]);
+		const SimdVec b2 = simdset((char)B->bytes[B->n > 2 ? 2 : 0]);
+		for (; i+SIMDWIDTH <= l; i += SIMDWIDTH) {
+			const SimdVec v = simdload(s+i);
+			unsigned int mask = simdbits(simdor(simdeq(v, b0),
+			                             simdor(simdeq(v, b1), simdeq(v, b2))));
+			mask ^= flip;
+			if (mask) return i+(size_t)lowbit(mask);
+		}
+	}
+#if defined(SIMDSHUFFLE)
+	else {
+		const SimdVec lo = simdtable(B->lo), hi = simdtable(B->hi);
+		const SimdVec lobits = simdtable(nibblebits[0]);
+		const SimdVec hibits = simdtable(nibblebits[1]);
+		const SimdVec nibble = simdset(0x0f), zero = simdset(0);
+		for (; i+SIMDWIDTH <= l; i += SIMDWIDTH) {
+			const SimdVec v = simdload(s+i);
+			const SimdVec vl = simdand(v, nibble), vh = simdnibble(v);
+			SimdVec found = simdor(
+				simdand(simdshuffle(lo, vl), simdshuffle(lobits, vh)),
+				simdand(simdshuffle(hi, vl), simdshuffle(hibits, vh)));
+			unsigned int mask = simdbits(simdeq(found, zero)) ^ SIMDALLEQUAL;
+			mask ^= flip;
+			if (mask) return i+(size_t)lowbit(mask);
+		}
+	}
+#endif
+#endif
+	for (; i < l; i++)
+		if (inbyteset(B, (unsigned char)s[i]) == (uint32_t)in) break;
+	return i;
+}
+
+static int scanwith (lua_State *L, int in) {
+	size_t len, sl, i, n;
+	const char *p = luamem_checkarray(L, 1, &len);
+	const char *s = luamem_checkarray(L, 2, &sl);
+	ByteSet B;
+	i = getrange(L, 3, 4, len, &n);
+	initbyteset(&B, s, sl);
+	if (n > 0) {
+		size_t k = scanbytes(&B, p+i, n, in);
+		if (k < n) {
+			lua_pushinteger(L, (lua_Integer)(i+k)+1);
+			return 1;
+		}
+	}
+	luaL_pushfail(L);
+	return 1;
+}
+
+static int mem_find (lua_State *L) {
+	return findwith(L, 1, 2, 0);
+}
+
+static int mem_rfind (lua_State *L) {
+	return findwith(L, 1, 2, 1);
+}
+
+static int mem_findall (lua_State *L) {
+	return findallwith(L, 1, 2);
+}
+
+static int mem_split (lua_State *L) {
+	size_t len, i, j;
+	const Searcher *S = (const Searcher *)luaL_testudata(L, 2, SEARCHER);
+	luamem_checkarray(L, 1, &len);
+	if (S == NULL) {
+		size_t sl;
+		const char *s = luamem_checkarray(L, 2, &sl);
+		S = newsearcher(L, s, sl);
+		lua_replace(L, 2);
+	}
+	luaL_argcheck(L, S->len > 0, 2, "empty separator");
+	i = posrelatI(luaL_optinteger(L, 3, 1), len) - 1;
+	j = getendpos(L, 4, -1, len);
+	lua_settop(L, 2);
+	lua_pushinteger(L, (lua_Integer)i);
+	lua_pushinteger(L, (lua_Integer)j);
+	lua_pushcclosure(L, splitnext, 4);
+	return 1;
+}
+
+static int mem_findbyte (lua_State *L) {
+	return scanwith(L, 1);
+}
+
+static int mem_skipbytes (lua_State *L) {
+	return scanwith(L, 0);
+}
+
+static int mem_findpattern (lua_State *L) {
+	return str_find_aux(L, 1);
+}
+
+static int mem_match (lua_State *L) {
+	return str_find_aux(L, 0);
+}
+
+static int mem_gmatch (lua_State *L) {
+	return gmatch(L);
+}
+
+static int mem_searcher (lua_State *L) {
+	size_t l;
+	const char *s = luamem_checkarray(L, 1, &l);
+	newsearcher(L, s, l);
+	return 1;
+}
+
+static int searcher_find (lua_State *L) {
+	return findwith(L, 2, 1, 0);
+}
+
+static int searcher_rfind (lua_State *L) {
+	return findwith(L, 2, 1, 1);
+}
+
+static int searcher_findall (lua_State *L) {
+	return findallwith(L, 2, 1);
+}
+
+static int searcher_len (lua_State *L) {
+	Searcher *S = (Searcher *)luaL_checkudata(L, 1, SEARCHER);
+	lua_pushinteger(L, (lua_Integer)S->len);
+	return 1;
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** PACK/UNPACK
+** =======================================================
+*/
+
+static int packfailed (lua_State *L, size_t i, size_t arg) {
+	lua_pushboolean(L, 0);
+	lua_replace(L, arg-2);
+	lua_pushinteger(L, i+1);
+	lua_replace(L, arg-1);
+	return 3+lua_gettop(L)-arg;
+}
+
+static int packwith (lua_State *L, int marg, int larg) {
+	size_t lb;
+	char *mem = checkwritable(L, marg, &lb);
+	luamem_Layout *layout = luamem_checklayout(L, larg);
+	size_t i = posrelatI(luaL_checkinteger(L, 3), lb) - 1;
+	int arg = 4;  /* first argument to pack */
+	luaL_argcheck(L, i <= lb, 3, "index out of bounds");
+	if (!luamem_packlayout(L, layout, mem, lb, &i, &arg))
+		return packfailed(L, i, arg);
+	lua_pushboolean(L, 1);
+	lua_pushinteger(L, i+1);
+	return 2;
+}
+
+static int unpackwith (lua_State *L, int marg, int larg) {
+	size_t ld;
+	const char *data = luamem_checkmemory(L, marg, &ld);
+	luamem_Layout *layout = luamem_checklayout(L, larg);
+	size_t pos = posrelatI(luaL_optinteger(L, 3, 1), ld) - 1;
+	int n;  /* number of results */
+	luaL_argcheck(L, pos <= ld, 3, "index out of bounds");
+	n = luamem_unpacklayout(L, layout, data, ld, &pos);
+	lua_pushinteger(L, pos + 1);  /* next position */
+	return n + 1;
+}
+
+static int mem_pack (lua_State *L) {
+	return packwith(L, 1, 2);
+}
+
+static int mem_unpack (lua_State *L) {
+	return unpackwith(L, 1, 2);
+}
+
+static int mem_layout (lua_State *L) {
+	luamem_newlayout(L, luaL_checkstring(L, 1));
+	return 1;
+}
+
+static int layout_pack (lua_State *L) {
+	return packwith(L, 2, 1);
+}
+
+static int layout_unpack (lua_State *L) {
+	return unpackwith(L, 2, 1);
+}
+
+static int layout_packsize (lua_State *L) {
+	size_t size;
+	luamem_Layout *layout = (luamem_Layout *)luaL_checkudata(L, 1, LUAMEM_LAYOUT);
+	luaL_argcheck(L, luamem_layoutsize(layout, &size), 1, "variable-length format");
+	lua_pushinteger(L, (lua_Integer)size);
+	return 1;
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** BUILDERS
+** =======================================================
+*/
+
+#define BUILDER	"luamem_Builder"
+
+/*
+** A builder appends bytes at the end of the resizable memory in its
+** user value, which grows with amortized doubling of its capacity.
+*/
+
+/* replaces the builder at index 1 by its memory */
+static char *tobuilder (lua_State *L, size_t *len) {
+	luaL_checkudata(L, 1, BUILDER);
+	lua_getiuservalue(L, 1, 1);
+	lua_replace(L, 1);
+	return luamem_tomemory(L, 1, len);
+}
+
+static int mem_builder (lua_State *L) {
+	if (lua_isnoneornil(L, 1)) {
+		luamem_newref(L);
+		luamem_resetref(L, -1, NULL, 0, luamem_free, 0);
+	}
+	else {
+		luamem_Unref unref;
+		luamem_tomemoryx(L, 1, NULL, &unref, NULL);
+		luaL_argcheck(L, unref == luamem_free, 1, "resizable memory expected");
+		lua_pushvalue(L, 1);
+	}
+	lua_newuserdatauv(L, 0, 1);
+	luaL_setmetatable(L, BUILDER);
+	lua_insert(L, -2);
+	lua_setiuservalue(L, -2, 1);
+	return 1;
+}
+
+/*
+** Packs the values from argument 3 at the end of the memory, which is
+** grown once to fit all of them after they are checked, so the memory
+** is left unchanged if any of them is invalid.
+*/
+static int builder_pack (lua_State *L) {
+	luamem_Layout *layout = luamem_checklayout(L, 2);
+	size_t len, i;
+	int arg = 3;  /* first argument to pack */
+	char *mem;
+	tobuilder(L, &i);
+	len = luamem_packlayoutsize(L, layout, i, arg);
+	mem = luamem_growref(L, 1, len);
+	memset(mem+i, 0, (len-i)*sizeof(char));  /* bytes skipped by padding */
+	luamem_packlayout(L, layout, mem, len, &i, &arg);
+	return 0;
+}
+
+static int builder_add (lua_State *L) {
+	size_t len, sl, n, i;
+	tobuilder(L, &len);
+	luamem_checkarray(L, 2, &sl);
+	i = getrange(L, 3, 4, sl, &n);
+	if (n > 0) {
+		char *mem = luamem_growref(L, 1, len+n);
+		const char *s = luamem_toarray(L, 2, NULL);  /* 's' might be moved */
+		memmove(mem+len, s+i, n*sizeof(char));
+	}
+	return 0;
+}
+
+static int builder_addint (lua_State *L) {
+	lua_Integer n = luaL_checkinteger(L, 2);
+	lua_Integer size = luaL_optinteger(L, 3, 8);
+	union { char b[8]; int8_t i8; int16_t i16; int32_t i32; int64_t i64; } u;
+	size_t len;
+	switch (size) {
+		case 1: u.i8 = (int8_t)n; break;
+		case 2: u.i16 = (int16_t)n; break;
+		case 4: u.i32 = (int32_t)n; break;
+		case 8: u.i64 = (int64_t)n; break;
+		default: return luaL_argerror(L, 3, "invalid size");
+	}
+	if (size < 8) {
+		lua_Integer lim = (lua_Integer)1 << ((size * CHAR_BIT) - 1);
+		luaL_argcheck(L, -lim <= n && n < lim, 2, "integer overflow");
+	}
+	tobuilder(L, &len);
+	memcpy(luamem_growref(L, 1, len+(size_t)size)+len, u.b, (size_t)size);
+	return 0;
+}
+
+static int builder_adddouble (lua_State *L) {
+	double d = (double)luaL_checknumber(L, 2);
+	size_t len;
+	tobuilder(L, &len);
+	memcpy(luamem_growref(L, 1, len+sizeof(d))+len, &d, sizeof(d));
+	return 0;
+}
+
+static int builder_memory (lua_State *L) {
+	tobuilder(L, NULL);
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int builder_len (lua_State *L) {
+	size_t len;
+	tobuilder(L, &len);
+	lua_pushinteger(L, (lua_Integer)len);
+	return 1;
+}
+
+static int builder_tostring (lua_State *L) {
+	size_t len;
+	const char *mem = tobuilder(L, &len);
+	lua_pushlstring(L, mem, len);
+	return 1;
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** TYPED ARRAYS
+** =======================================================
+*/
+
+#define ARRAY	"luamem_Array"
+
+/* number of elements of swapped arrays converted at once by kernels */
+#define ARRAYCHUNK	256
+
+typedef enum ElemType {
+	Ti8, Tu8, Ti16, Tu16, Ti32, Tu32, Ti64, Tu64, Tf32, Tf64
+} ElemType;
+
+static const char *const elemnames[] = {
+	"i8", "u8", "i16", "u16", "i32", "u32", "i64", "u64", "f32", "f64", NULL
+};
+
+static const unsigned char elemsizes[] = { 1, 1, 2, 2, 4, 4, 8, 8, 4, 8 };
+
+#define isfloatelem(t)	((t) >= Tf32)
+
+/* dummy union to get native endianness */
+static const union {
+	int dummy;
+	char little;  /* true iff machine is little endian */
+} nativeendian = {1};
+
+typedef union Elem {
+	char b[8];
+	int8_t i8;
+	uint8_t u8;
+	int16_t i16;
+	uint16_t u16;
+	int32_t i32;
+	uint32_t u32;
+	int64_t i64;
+	uint64_t u64;
+	float f32;
+	double f64;
+} Elem;
+
+/*
+** An array refers to 'count' elements of 'type' from 'offset' of the
+** memory in its user value, and is empty while they are beyond the size
+** of this memory.
+*/
+typedef struct Array {
+	size_t offset;
+	size_t count;
+	ElemType type;
+	int swap;  /* elements are not in native byte order */
+} Array;
+
+static Array *checknumarray (lua_State *L, int arg) {
+	return (Array *)luaL_checkudata(L, arg, ARRAY);
+}
+
+/*
+** Gets the elements of array 'A' at argument 'arg', whose memory must
+** be writable when 'write' is true.
+*/
+static char *arraymem (lua_State *L, int arg, const Array *A, size_t *n,
+                       int write) {
+	size_t len;
+	char *p;
+	lua_getiuservalue(L, arg, 1);
+	p = luamem_tomemory(L, -1, &len);
+	if (write) luaL_argcheck(L, !isreadonly(L, -1), arg, "read-only memory");
+	lua_pop(L, 1);  /* memory is kept by the array */
+	if (len < A->offset ||
+	    (len - A->offset) / elemsizes[A->type] < A->count) {  /* gone? */
+		*n = 0;
+		return NULL;
+	}
+	*n = A->count;
+	return p + A->offset;
+}
+
+static void swapelems (char *dst, const char *src, size_t size, size_t n) {
+	size_t k, b;
+	for (k = 0; k < n; k++, dst += size, src += size)
+		for (b = 0; b < size; b++) dst[b] = src[size-1-b];
+}
+
+static void pushelem (lua_State *L, const char *p, const Array *A) {
+	Elem e;
+	if (A->swap) swapelems(e.b, p, elemsizes[A->type], 1);
+	else memcpy(e.b, p, elemsizes[A->type]);
+	switch (A->type) {
+		case Ti8: lua_pushinteger(L, e.i8); break;
+		case Tu8: lua_pushinteger(L, e.u8); break;
+		case Ti16: lua_pushinteger(L, e.i16); break;
+		case Tu16: lua_pushinteger(L, e.u16); break;
+		case Ti32: lua_pushinteger(L, e.i32); break;
+		case Tu32: lua_pushinteger(L, (lua_Integer)e.u32); break;
+		case Ti64: lua_pushinteger(L, (lua_Integer)e.i64); break;
+		case Tu64: lua_pushinteger(L, (lua_Integer)e.u64); break;
+		case Tf32: lua_pushnumber(L, (lua_Number)e.f32); break;
+		case Tf64: lua_pushnumber(L, (lua_Number)e.f64); break;
+	}
+}
+
+#define checkelem(L,arg,v,min,max)  \
+	luaL_argcheck(L, (min) <= (v) && (v) <= (max), arg, "value out of range")
+
+static void setelem (lua_State *L, int arg, char *p, const Array *A) {
+	Elem e;
+	if (isfloatelem(A->type)) {
+		lua_Number v = luaL_checknumber(L, arg);
+		if (A->type == Tf32) e.f32 = (float)v;
+		else e.f64 = (double)v;
+	}
+	else {
+		lua_Integer v = luaL_checkinteger(L, arg);
+		switch (A->type) {
+			case Ti8: checkelem(L, arg, v, INT8_MIN, INT8_MAX); e.i8 = (int8_t)v; break;
+			case Tu8: checkelem(L, arg, v, 0, UINT8_MAX); e.u8 = (uint8_t)v; break;
+			case Ti16: checkelem(L, arg, v, INT16_MIN, INT16_MAX); e.i16 = (int16_t)v; break;
+			case Tu16: checkelem(L, arg, v, 0, UINT16_MAX); e.u16 = (uint16_t)v; break;
+			case Ti32: checkelem(L, arg, v, INT32_MIN, INT32_MAX); e.i32 = (int32_t)v; break;
+			case Tu32: checkelem(L, arg, v, 0, (lua_Integer)UINT32_MAX); e.u32 = (uint32_t)v; break;
+			default: e.i64 = (int64_t)v; break;  /* 64-bit integers wrap around */
+		}
+	}
+	if (A->swap) swapelems(p, e.b, elemsizes[A->type], 1);
+	else memcpy(p, e.b, elemsizes[A->type]);
+}
+
+/*
+** Kernels process arrays in native byte order, and update the results in
+** 'Kernel' so they can process an array in many chunks. Their loops use
+** 'memcpy' to load and store elements that might not be aligned, which
+** compilers turn into vector instructions.
+*/
+typedef struct Kernel {
+	lua_Unsigned i;  /* integer result (wraps around) */
+	lua_Number f;  /* float result */
+	lua_Unsigned xi;  /* integer operand */
+	lua_Number xf;  /* float operand */
+	Elem e;  /* minimum or maximum element */
+	int found;  /* whether 'e' was set */
+} Kernel;
+
+typedef void (*KernelF) (Kernel *K, ElemType t, char *p, const char *q,
+                         size_t n);
+
+#define loadelem(T,v,p,k)	memcpy(&(v), (p)+(k)*sizeof(T), sizeof(T))
+#define storeelem(T,v,p,k)	memcpy((p)+(k)*sizeof(T), &(v), sizeof(T))
+
+/* expands kernel 'K' for the type of elements 't' */
+#define kerneltypes(K) switch (t) {  \
+	case Ti8: K(int8_t, lua_Unsigned, i); break;  \
+	case Tu8: K(uint8_t, lua_Unsigned, i); break;  \
+	case Ti16: K(int16_t, lua_Unsigned, i); break;  \
+	case Tu16: K(uint16_t, lua_Unsigned, i); break;  \
+	case Ti32: K(int32_t, lua_Unsigned, i); break;  \
+	case Tu32: K(uint32_t, lua_Unsigned, i); break;  \
+	case Ti64: K(int64_t, lua_Unsigned, i); break;  \
+	case Tu64: K(uint64_t, lua_Unsigned, i); break;  \
+	case Tf32: K(float, lua_Number, f); break;  \
+	case Tf64: K(double, lua_Number, f); break;  \
+}
+
+/* four independent sums, so additions of floats can be vectorized */
+#define sumelems(T,C,R) {  \
+	C s[4] = {0, 0, 0, 0};  \
+	size_t k = 0;  \
+	for (; k+4 <= n; k += 4) {  \
+		T v[4];  \
+		memcpy(v, p+k*sizeof(T), sizeof(v));  \
+		s[0] += (C)v[0]; s[1] += (C)v[1]; s[2] += (C)v[2]; s[3] += (C)v[3];  \
+	}  \
+	for (; k < n; k++) {  \
+		T v;  \
+		loadelem(T, v, p, k);  \
+		s[0] += (C)v;  \
+	}  \
+	K->R += (s[0]+s[1])+(s[2]+s[3]); }
+
+#define dotelems(T,C,R) {  \
+	C s[4] = {0, 0, 0, 0};  \
+	size_t k = 0;  \
+	for (; k+4 <= n; k += 4) {  \
+		T v[4], w[4];  \
+		memcpy(v, p+k*sizeof(T), sizeof(v));  \
+		memcpy(w, q+k*sizeof(T), sizeof(w));  \
+		s[0] += (C)v[0]*(C)w[0]; s[1] += (C)v[1]*(C)w[1];  \
+		s[2] += (C)v[2]*(C)w[2]; s[3] += (C)v[3]*(C)w[3];  \
+	}  \
+	for (; k < n; k++) {  \
+		T v, w;  \
+		loadelem(T, v, p, k);  \
+		loadelem(T, w, q, k);  \
+		s[0] += (C)v*(C)w;  \
+	}  \
+	K->R += (s[0]+s[1])+(s[2]+s[3]); }
+
+#define extremeloop(T,OP) {  \
+	T m;  \
+	size_t k = 0;  \
+	if (K->found) memcpy(&m, K->e.b, sizeof(T));  \
+	else if (n > 0) loadelem(T, m, p, k++);  \
+	for (; k < n; k++) {  \
+		T v;  \
+		loadelem(T, v, p, k);  \
+		if (v OP m) m = v;  \
+	}  \
+	if (n > 0) {  \
+		memcpy(K->e.b, &m, sizeof(T));  \
+		K->found = 1;  \
+	} }
+
+#define minelems(T,C,R)	extremeloop(T, <)
+#define maxelems(T,C,R)	extremeloop(T, >)
+
+#define scaleelems(T,C,R) {  \
+	size_t k;  \
+	for (k = 0; k < n; k++) {  \
+		T v;  \
+		loadelem(T, v, p, k);  \
+		v = (T)((C)v * K->x##R);  \
+		storeelem(T, v, p, k);  \
+	} }
+
+#define addelems(T,C,R) {  \
+	size_t k;  \
+	if (q) for (k = 0; k < n; k++) {  \
+		T v, w;  \
+		loadelem(T, v, p, k);  \
+		loadelem(T, w, q, k);  \
+		v = (T)((C)v + (C)w);  \
+		storeelem(T, v, p, k);  \
+	}  \
+	else for (k = 0; k < n; k++) {  \
+		T v;  \
+		loadelem(T, v, p, k);  \
+		v = (T)((C)v + K->x##R);  \
+		storeelem(T, v, p, k);  \
+	} }
+
+static void sumkernel (Kernel *K, ElemType t, char *p, const char *q,
+                       size_t n) {
+	(void)q;
+	kerneltypes(sumelems)
+}
+
+static void dotkernel (Kernel *K, ElemType t, char *p, const char *q,
+                       size_t n) {
+	kerneltypes(dotelems)
+}
+
+static void minkernel (Kernel *K, ElemType t, char *p, const char *q,
+                       size_t n) {
+	(void)q;
+	kerneltypes(minelems)
+}
+
+static void maxkernel (Kernel *K, ElemType t, char *p, const char *q,
+                       size_t n) {
+	(void)q;
+	kerneltypes(maxelems)
+}
+
+static void scalekernel (Kernel *K, ElemType t, char *p, const char *q,
+                         size_t n) {
+	(void)q;
+	kerneltypes(scaleelems)
+}
+
+static void addkernel (Kernel *K, ElemType t, char *p, const char *q,
+                       size_t n) {
+	kerneltypes(addelems)
+}
+
+/*
+** Runs kernel 'f' over the elements of array 'A' at argument 1 (and of
+** array 'B' at argument 2 if not NULL), converting chunks of swapped
+** arrays to native byte order, and converting them back if 'update'.
+*/
+static void runkernel (lua_State *L, KernelF f, Kernel *K, int update) {
+	size_t n, nb = 0;
+	Array *A = checknumarray(L, 1);
+	Array *B = NULL;
+	char *p = arraymem(L, 1, A, &n, update);
+	const char *q = NULL;
+	if (!lua_isnoneornil(L, 2) && luaL_testudata(L, 2, ARRAY)) {
+		B = (Array *)lua_touserdata(L, 2);
+		q = arraymem(L, 2, B, &nb, 0);
+		luaL_argcheck(L, B->type == A->type && nb == n, 2,
+		                 "array of same type and length expected");
+	}
+	if (!A->swap && !(B && B->swap)) f(K, A->type, p, q, n);
+	else {
+		size_t size = elemsizes[A->type], k;
+		Elem bufp[ARRAYCHUNK], bufq[ARRAYCHUNK];  /* aligned buffers */
+		for (k = 0; k < n; k += ARRAYCHUNK) {
+			size_t c = n-k < ARRAYCHUNK ? n-k : ARRAYCHUNK;
+			char *cp = p+k*size;
+			const char *cq = q ? q+k*size : NULL;
+			if (A->swap) {
+				swapelems(bufp[0].b, cp, size, c);
+				cp = bufp[0].b;
+			}
+			if (B && B->swap) {
+				swapelems(bufq[0].b, cq, size, c);
+				cq = bufq[0].b;
+			}
+			f(K, A->type, cp, cq, c);
+			if (update && A->swap) swapelems(p+k*size, cp, size, c);
+		}
+	}
+}
+
+static int mem_array (lua_State *L) {
+	size_t len, i, n;
+	const char *name = luaL_checkstring(L, 2);
+	int little = nativeendian.little;
+	ElemType t;
+	Array *A;
+	luamem_checkmemory(L, 1, &len);
+	switch (*name) {
+		case '<': little = 1; name++; break;
+		case '>': little = 0; name++; break;
+		case '=': name++; break;
+	}
+	for (t = Ti8; elemnames[t] && strcmp(elemnames[t], name) != 0; t++);
+	if (elemnames[t] == NULL)
+		return luaL_argerror(L, 2,
+		                     lua_pushfstring(L, "invalid element type '%s'", name));
+	i = getrange(L, 3, 4, len, &n);
+	A = (Array *)lua_newuserdatauv(L, sizeof(Array), 1);
+	A->offset = i;
+	A->count = n / elemsizes[t];
+	A->type = t;
+	A->swap = (elemsizes[t] > 1 && little != nativeendian.little);
+	luaL_setmetatable(L, ARRAY);
+	lua_pushvalue(L, 1);
+	lua_setiuservalue(L, -2, 1);  /* keep memory */
+	return 1;
+}
+
+static int array_index (lua_State *L) {
+	Array *A = checknumarray(L, 1);
+	if (lua_type(L, 2) == LUA_TNUMBER) {
+		int isint;
+		lua_Integer k = lua_tointegerx(L, 2, &isint);
+		size_t n;
+		const char *p = arraymem(L, 1, A, &n, 0);
+		if (isint && 1 <= k && (lua_Unsigned)k <= n)
+			pushelem(L, p+(size_t)(k-1)*elemsizes[A->type], A);
+		else lua_pushnil(L);
+	}
+	else {
+		lua_settop(L, 2);
+		lua_rawget(L, lua_upvalueindex(1));  /* get method */
+	}
+	return 1;
+}
+
+static int array_newindex (lua_State *L) {
+	Array *A = checknumarray(L, 1);
+	lua_Integer k = luaL_checkinteger(L, 2);
+	size_t n;
+	char *p = arraymem(L, 1, A, &n, 1);
+	luaL_argcheck(L, 1 <= k && (lua_Unsigned)k <= n, 2, "index out of bounds");
+	setelem(L, 3, p+(size_t)(k-1)*elemsizes[A->type], A);
+	return 0;
+}
+
+static int array_len (lua_State *L) {
+	size_t n;
+	arraymem(L, 1, checknumarray(L, 1), &n, 0);
+	lua_pushinteger(L, (lua_Integer)n);
+	return 1;
+}
+
+static int pushkernel (lua_State *L, const Kernel *K) {
+	Array *A = (Array *)lua_touserdata(L, 1);
+	if (isfloatelem(A->type)) lua_pushnumber(L, K->f);
+	else lua_pushinteger(L, (lua_Integer)K->i);
+	return 1;
+}
+
+static int array_sum (lua_State *L) {
+	Kernel K = {0, 0, 0, 0, {{0}}, 0};
+	lua_settop(L, 1);
+	runkernel(L, sumkernel, &K, 0);
+	return pushkernel(L, &K);
+}
+
+static int array_dot (lua_State *L) {
+	Kernel K = {0, 0, 0, 0, {{0}}, 0};
+	luaL_checkudata(L, 2, ARRAY);
+	runkernel(L, dotkernel, &K, 0);
+	return pushkernel(L, &K);
+}
+
+static int extremewith (lua_State *L, KernelF f) {
+	Kernel K = {0, 0, 0, 0, {{0}}, 0};
+	Array *A, native;
+	lua_settop(L, 1);
+	runkernel(L, f, &K, 0);
+	if (!K.found) return 0;
+	A = (Array *)lua_touserdata(L, 1);
+	native = *A;
+	native.swap = 0;  /* kernels find elements in native byte order */
+	pushelem(L, K.e.b, &native);
+	return 1;
+}
+
+static int array_min (lua_State *L) {
+	return extremewith(L, minkernel);
+}
+
+static int array_max (lua_State *L) {
+	return extremewith(L, maxkernel);
+}
+
+static void operand (lua_State *L, int arg, Kernel *K) {
+	Array *A = (Array *)lua_touserdata(L, 1);
+	if (isfloatelem(A->type)) K->xf = luaL_checknumber(L, arg);
+	else K->xi = (lua_Unsigned)luaL_checkinteger(L, arg);
+}
+
+static int array_scale (lua_State *L) {
+	Kernel K = {0, 0, 0, 0, {{0}}, 0};
+	checknumarray(L, 1);
+	operand(L, 2, &K);
+	lua_settop(L, 1);
+	runkernel(L, scalekernel, &K, 1);
+	return 1;
+}
+
+static int array_add (lua_State *L) {
+	Kernel K = {0, 0, 0, 0, {{0}}, 0};
+	checknumarray(L, 1);
+	if (!luaL_testudata(L, 2, ARRAY)) {
+		operand(L, 2, &K);
+		lua_settop(L, 1);
+	}
+	runkernel(L, addkernel, &K, 1);
+	lua_settop(L, 1);
+	return 1;
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** CHECKSUMS AND HASHES
+** =======================================================
+*/
+
+#define XXH64STATE	"luamem_XXH64State"
+
+/*
+** CRC-32 and CRC-32C are computed with slicing-by-8 tables 'crc32tab' and
+** 'crc32ctab' of their reflected polynomials 0xedb88320 and 0x82f63b78,
+** which are defined in 'lmemtab.h'.
+*/
+
+#define read32le(p)  \
+	((uint32_t)(p)[0] | (uint32_t)(p)[1] << 8 |  \
+	 (uint32_t)(p)[2] << 16 | (uint32_t)(p)[3] << 24)
+
+#define read64le(p)	((uint64_t)read32le(p) | (uint64_t)read32le((p)+4) << 32)
+
+/* updates the (inverted) CRC 'c' with 8 bytes at a time */
+static uint32_t crcslice8 (const uint32_t tab[8][256], uint32_t c,
+                           const unsigned char *p, size_t n) {
+	for (; n >= 8; n -= 8, p += 8) {
+		uint32_t lo = c ^ read32le(p);
+		uint32_t hi = read32le(p+4);
+		c = tab[7][lo & 0xff] ^ tab[6][(lo >> 8) & 0xff] ^
+		    tab[5][(lo >> 16) & 0xff] ^ tab[4][lo >> 24] ^
+		    tab[3][hi & 0xff] ^ tab[2][(hi >> 8) & 0xff] ^
+		    tab[1][(hi >> 16) & 0xff] ^ tab[0][hi >> 24];
+	}
+	for (; n > 0; n--, p++) c = tab[0][(c ^ *p) & 0xff] ^ (c >> 8);
+	return c;
+}
+
+#if defined(CRC32CHW)
+static CRC32CHW uint32_t crc32chw (uint32_t c, const unsigned char *p,
+                                   size_t n) {
+#if defined(__x86_64__)
+	uint64_t c64 = c;
+	for (; n >= 8; n -= 8, p += 8) {
+		uint64_t w;
+		memcpy(&w, p, sizeof(w));
+		c64 = _mm_crc32_u64(c64, w);
+	}
+	c = (uint32_t)c64;
+#endif
+	for (; n >= 4; n -= 4, p += 4) {
+		uint32_t w;
+		memcpy(&w, p, sizeof(w));
+		c = _mm_crc32_u32(c, w);
+	}
+	for (; n > 0; n--, p++) c = _mm_crc32_u8(c, *p);
+	return c;
+}
+#endif
+
+/*
+** Gets the bytes from arguments 2 until 3 of the memory or string at
+** argument 1, and the initial value from argument 4.
+*/
+static const unsigned char *checkhashed (lua_State *L, size_t *n) {
+	size_t len, i;
+	const char *s = luamem_checkarray(L, 1, &len);
+	i = getrange(L, 2, 3, len, n);
+	return (const unsigned char *)s+i;
+}
+
+static int mem_crc32 (lua_State *L) {
+	size_t n;
+	const unsigned char *p = checkhashed(L, &n);
+	uint32_t c = (uint32_t)luaL_optinteger(L, 4, 0);
+	c = ~crcslice8(crc32tab, ~c, p, n);
+	lua_pushinteger(L, (lua_Integer)c);
+	return 1;
+}
+
+static int mem_crc32c (lua_State *L) {
+	size_t n;
+	const unsigned char *p = checkhashed(L, &n);
+	uint32_t c = (uint32_t)luaL_optinteger(L, 4, 0);
+#if defined(CRC32CHW)
+	if (hascrc32chw()) c = ~crc32chw(~c, p, n);
+	else
+#endif
+	c = ~crcslice8(crc32ctab, ~c, p, n);
+	lua_pushinteger(L, (lua_Integer)c);
+	return 1;
+}
+
+#define XXH64P1	UINT64_C(0x9e3779b185ebca87)
+#define XXH64P2	UINT64_C(0xc2b2ae3d27d4eb4f)
+#define XXH64P3	UINT64_C(0x165667b19e3779f9)
+#define XXH64P4	UINT64_C(0x85ebca77c2b2ae63)
+#define XXH64P5	UINT64_C(0x27d4eb2f165667c5)
+
+#define rotl64(x,r)	(((x) << (r)) | ((x) >> (64-(r))))
+
+/*
+** State of an XXH64 hash of a stream, with the last bytes that do not
+** fill a stripe of 32 bytes.
+*/
+typedef struct XXH64State {
+	uint64_t total;  /* number of bytes hashed */
+	uint64_t seed;
+	uint64_t acc[4];
+	unsigned char buffer[32];
+	size_t buffered;
+} XXH64State;
+
+static uint64_t xxh64round (uint64_t acc, uint64_t input) {
+	acc += input * XXH64P2;
+	acc = rotl64(acc, 31);
+	return acc * XXH64P1;
+}
+
+static uint64_t xxh64merge (uint64_t h, uint64_t acc) {
+	h ^= xxh64round(0, acc);
+	return h * XXH64P1 + XXH64P4;
+}
+
+static void xxh64init (XXH64State *S, uint64_t seed) {
+	S->total = 0;
+	S->seed = seed;
+	S->acc[0] = seed + XXH64P1 + XXH64P2;
+	S->acc[1] = seed + XXH64P2;
+	S->acc[2] = seed;
+	S->acc[3] = seed - XXH64P1;
+	S->buffered = 0;
+}
+
+/* processes whole stripes of 32 bytes, returning the bytes processed */
+static size_t xxh64stripes (XXH64State *S, const unsigned char *p,
+                            size_t n) {
+	uint64_t a0 = S->acc[0], a1 = S->acc[1], a2 = S->acc[2], a3 = S->acc[3];
+	size_t k;
+	for (k = 0; k+32 <= n; k += 32) {
+		a0 = xxh64round(a0, read64le(p+k));
+		a1 = xxh64round(a1, read64le(p+k+8));
+		a2 = xxh64round(a2, read64le(p+k+16));
+		a3 = xxh64round(a3, read64le(p+k+24));
+	}
+	S->acc[0] = a0; S->acc[1] = a1; S->acc[2] = a2; S->acc[3] = a3;
+	return k;
+}
+
+static void xxh64update (XXH64State *S, const unsigned char *p, size_t n) {
+	size_t k;
+	S->total += n;
+	if (S->buffered > 0) {  /* complete the buffered stripe first */
+		size_t c = 32 - S->buffered;
+		if (c > n) c = n;
+		memcpy(S->buffer+S->buffered, p, c);
+		S->buffered += c;
+		p += c;
+		n -= c;
+		if (S->buffered < 32) return;
+		xxh64stripes(S, S->buffer, 32);
+		S->buffered = 0;
+	}
+	k = xxh64stripes(S, p, n);
+	memcpy(S->buffer, p+k, n-k);
+	S->buffered = n-k;
+}
+
+static uint64_t xxh64digest (const XXH64State *S) {
+	const unsigned char *p = S->buffer;
+	size_t n = S->buffered;
+	uint64_t h;
+	if (S->total >= 32) {
+		h = rotl64(S->acc[0], 1) + rotl64(S->acc[1], 7) +
+		    rotl64(S->acc[2], 12) + rotl64(S->acc[3], 18);
+		h = xxh64merge(h, S->acc[0]);
+		h = xxh64merge(h, S->acc[1]);
+		h = xxh64merge(h, S->acc[2]);
+		h = xxh64merge(h, S->acc[3]);
+	}
+	else h = S->seed + XXH64P5;
+	h += S->total;
+	for (; n >= 8; n -= 8, p += 8) {
+		h ^= xxh64round(0, read64le(p));
+		h = rotl64(h, 27) * XXH64P1 + XXH64P4;
+	}
+	if (n >= 4) {
+		h ^= (uint64_t)read32le(p) * XXH64P1;
+		h = rotl64(h, 23) * XXH64P2 + XXH64P3;
+		n -= 4;
+		p += 4;
+	}
+	for (; n > 0; n--, p++) {
+		h ^= *p * XXH64P5;
+		h = rotl64(h, 11) * XXH64P1;
+	}
+	h ^= h >> 33;
+	h *= XXH64P2;
+	h ^= h >> 29;
+	h *= XXH64P3;
+	h ^= h >> 32;
+	return h;
+}
+
+static int mem_xxhash64 (lua_State *L) {
+	size_t n;
+	const unsigned char *p = checkhashed(L, &n);
+	XXH64State *S = (XXH64State *)luaL_testudata(L, 4, XXH64STATE);
+	XXH64State local;
+	if (S == NULL) {  /* hash only the given bytes */
+		S = &local;
+		xxh64init(S, (uint64_t)luaL_optinteger(L, 4, 0));
+	}
+	xxh64update(S, p, n);
+	lua_pushinteger(L, (lua_Integer)xxh64digest(S));
+	return 1;
+}
+
+static int mem_xxhash64state (lua_State *L) {
+	uint64_t seed = (uint64_t)luaL_optinteger(L, 1, 0);
+	XXH64State *S = (XXH64State *)lua_newuserdatauv(L, sizeof(XXH64State), 0);
+	xxh64init(S, seed);
+	luaL_setmetatable(L, XXH64STATE);
+	return 1;
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** ENCODING
+** =======================================================
+*/
+
+enum { CODEC_HEX, CODEC_BASE64, CODEC_BASE64URL };
+
+static const char *const codecnames[] = {
+	"hex", "base64", "base64url", NULL
+};
+
+static const char hexdigits[] = "0123456789abcdef";
+
+static const char b64digits[2][65] = {
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/",
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"
+};
+
+#define b64digitsof(c)	b64digits[(c) == CODEC_BASE64URL]
+
+/* values of the digits of each codec are in 'digitvalues' ('lmemtab.h') */
+
+/* number of source bytes and encoded bytes of whole groups of a codec */
+#define groupsize(c)	((c) == CODEC_HEX ? 1 : 3)
+#define codesize(c)	((c) == CODEC_HEX ? 2 : 4)
+
+/* size of the encoding of the last 'r' bytes of base64 data */
+#define b64tailsize(c,r)  \
+	((r) == 0 ? 0 : (c) == CODEC_BASE64URL ? (r)+1 : 4)
+
+#if defined(__SSE2__)
+/* converts vector 'v' of nibbles into hexadecimal digits */
+static __m128i hexvec (__m128i v) {
+	__m128i letters = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(9)),
+	                                _mm_set1_epi8('a'-'0'-10));
+	return _mm_add_epi8(_mm_add_epi8(v, _mm_set1_epi8('0')), letters);
+}
+#endif
+
+static void encodehex (char *d, const unsigned char *s, size_t n) {
+#if defined(__SSE2__)
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	for (; n >= 16; n -= 16, s += 16, d += 32) {
+		__m128i v = _mm_loadu_si128((const __m128i *)s);
+		__m128i hi = hexvec(_mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+		__m128i lo = hexvec(_mm_and_si128(v, nibble));
+		_mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *)(d+16), _mm_unpackhi_epi8(hi, lo));
+	}
+#endif
+	for (; n > 0; n--, s++, d += 2) {
+		d[0] = hexdigits[*s >> 4];
+		d[1] = hexdigits[*s & 0x0f];
+	}
+}
+
+/* encodes 'n' bytes, including a last partial group; returns its size */
+static size_t encodeb64 (char *d, const unsigned char *s, size_t n,
+                         int codec) {
+	const char *digits = b64digitsof(codec);
+	char *start = d;
+	for (; n >= 3; n -= 3, s += 3, d += 4) {
+		uint32_t v = (uint32_t)s[0] << 16 | (uint32_t)s[1] << 8 | s[2];
+		d[0] = digits[v >> 18];
+		d[1] = digits[(v >> 12) & 0x3f];
+		d[2] = digits[(v >> 6) & 0x3f];
+		d[3] = digits[v & 0x3f];
+	}
+	if (n > 0) {
+		uint32_t v = (uint32_t)s[0] << 16 | (n > 1 ? (uint32_t)s[1] << 8 : 0);
+		*d++ = digits[v >> 18];
+		*d++ = digits[(v >> 12) & 0x3f];
+		if (n > 1) *d++ = digits[(v >> 6) & 0x3f];
+		if (codec == CODEC_BASE64) {
+			if (n == 1) *d++ = '=';
+			*d++ = '=';
+		}
+	}
+	return (size_t)(d - start);
+}
+
+/*
+** Decodes 'n' digits (without padding) of 's' into 'd', and returns the
+** number of digits decoded, which is less than 'n' only if there is an
+** invalid digit right after them.
+*/
+static size_t decodedigits (char *d, const unsigned char *s, size_t n,
+                            int codec) {
+	const signed char *values = digitvalues[codec];
+	size_t k = 0;
+	if (codec == CODEC_HEX) {
+		for (; k+2 <= n; k += 2) {
+			int hi = values[s[k]], lo = values[s[k+1]];
+			if ((hi | lo) < 0) break;
+			*d++ = (char)(hi << 4 | lo);
+		}
+	}
+	else {
+		for (; k+4 <= n; k += 4) {
+			int a = values[s[k]], b = values[s[k+1]];
+			int c = values[s[k+2]], e = values[s[k+3]];
+			uint32_t v;
+			if ((a | b | c | e) < 0) break;
+			v = (uint32_t)a << 18 | (uint32_t)b << 12 | (uint32_t)c << 6 | (uint32_t)e;
+			d[0] = (char)(v >> 16);
+			d[1] = (char)(v >> 8);
+			d[2] = (char)v;
+			d += 3;
+		}
+		if (k < n && n-k < 4) {  /* last partial group? */
+			int a = values[s[k]], b = values[s[k+1]];
+			int c = n-k > 2 ? values[s[k+2]] : 0;
+			if ((a | b | c) >= 0) {
+				uint32_t v = (uint32_t)a << 18 | (uint32_t)b << 12 | (uint32_t)c << 6;
+				*d++ = (char)(v >> 16);
+				if (n-k > 2) *d = (char)(v >> 8);
+				k = n;
+			}
+		}
+	}
+	while (k < n && values[s[k]] >= 0) k++;  /* find the invalid digit */
+	return k;
+}
+
+/*
+** Gets the number of digits 'n' of encoded data 's', without padding,
+** and returns the size of its decoding, or raises an error if 's' is not
+** valid data of 'codec' (with 'pos' being the position of 's').
+*/
+static size_t decodedsize (lua_State *L, const char *s, size_t *n,
+                           int codec, size_t pos) {
+	size_t len = *n, r;
+	if (codec != CODEC_HEX) {
+		size_t pad = 0;
+		while (len > 0 && pad < 2 && s[len-1] == '=') {
+			len--;
+			pad++;
+		}
+		r = len % 4;
+		if (r == 1)  /* lone digit? */
+			luaL_error(L, "invalid %s data (at position %I)", codecnames[codec],
+			           (LUAI_UACINT)(pos+len-1));
+		if (pad > 0 && (len+pad) % 4 != 0)  /* misplaced padding? */
+			luaL_error(L, "invalid %s data (at position %I)", codecnames[codec],
+			           (LUAI_UACINT)(pos+len));
+		*n = len;
+		return len/4*3 + (r > 0 ? r-1 : 0);
+	}
+	if (len % 2 != 0)
+		luaL_error(L, "invalid %s data (at position %I)", codecnames[codec],
+		           (LUAI_UACINT)(pos+len-1));
+	return len/2;
+}
+
+static int mem_encode (lua_State *L) {
+	size_t dl, sl, n, space, take;
+	char *d = checkwritable(L, 1, &dl);
+	size_t di = posrelatI(luaL_checkinteger(L, 2), dl) - 1;
+	const unsigned char *s = (const unsigned char *)luamem_checkarray(L, 3, &sl);
+	size_t si = getrange(L, 4, 5, sl, &n);
+	int codec = luaL_checkoption(L, 6, NULL, codecnames);
+	size_t g = groupsize(codec), c = codesize(codec);
+	luaL_argcheck(L, di <= dl, 2, "index out of bounds");
+	space = dl-di;
+	take = (space/c < n/g) ? space/c*g : n;  /* whole groups that fit */
+	if (codec == CODEC_HEX) {
+		encodehex(d+di, s+si, take);
+		di += 2*take;
+	}
+	else {
+		if (take == n && space-n/3*4 < b64tailsize(codec, n%3))
+			take = n/3*3;  /* last partial group does not fit */
+		di += encodeb64(d+di, s+si, take, codec);
+	}
+	lua_pushinteger(L, (lua_Integer)di+1);
+	lua_pushinteger(L, (lua_Integer)(si+take)+1);
+	return 2;
+}
+
+static int mem_decode (lua_State *L) {
+	size_t dl, sl, n, m, k, space, size, take;
+	char *d = checkwritable(L, 1, &dl);
+	size_t di = posrelatI(luaL_checkinteger(L, 2), dl) - 1;
+	const char *s = luamem_checkarray(L, 3, &sl);
+	size_t si = getrange(L, 4, 5, sl, &n);
+	int codec = luaL_checkoption(L, 6, NULL, codecnames);
+	size_t g = groupsize(codec), c = codesize(codec);
+	luaL_argcheck(L, di <= dl, 2, "index out of bounds");
+	space = dl-di;
+	m = n;
+	size = decodedsize(L, s+si, &m, codec, si+1);
+	if (size <= space) take = m;
+	else take = space/g*c;  /* whole groups that fit */
+	k = decodedigits(d+di, (const unsigned char *)s+si, take, codec);
+	if (k < take)
+		return luaL_error(L, "invalid %s data (at position %I)",
+		                  codecnames[codec], (LUAI_UACINT)(si+k+1));
+	if (take == m) {  /* decoded everything? */
+		di += size;
+		take = n;  /* including padding */
+	}
+	else di += take/c*g;
+	lua_pushinteger(L, (lua_Integer)di+1);
+	lua_pushinteger(L, (lua_Integer)(si+take)+1);
+	return 2;
+}
+
+static int mem_encodelen (lua_State *L) {
+	lua_Integer n = luaL_checkinteger(L, 1);
+	int codec = luaL_checkoption(L, 2, NULL, codecnames);
+	lua_Integer size;
+	luaL_argcheck(L, n >= 0, 1, "invalid size");
+	if (l_unlikely(n/groupsize(codec) > LUA_MAXINTEGER/codesize(codec)-1))
+		return luaL_error(L, "resulting memory too large");
+	size = n/groupsize(codec)*codesize(codec);
+	if (codec != CODEC_HEX) size += b64tailsize(codec, n%3);
+	lua_pushinteger(L, size);
+	return 1;
+}
+
+static int mem_decodelen (lua_State *L) {
+	size_t sl, n;
+	const char *s = luamem_checkarray(L, 1, &sl);
+	size_t si = getrange(L, 2, 3, sl, &n);
+	int codec = luaL_checkoption(L, 4, NULL, codecnames);
+	lua_pushinteger(L, (lua_Integer)decodedsize(L, s+si, &n, codec, si+1));
+	return 1;
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** FILE I/O
+** =======================================================
+*/
+
+static FILE *tofile (lua_State *L, int arg) {
+	luaL_Stream *p = (luaL_Stream *)luaL_testudata(L, arg, LUA_FILEHANDLE);
+	if (p == NULL) return NULL;
+	if (p->closef == NULL)
+		luaL_error(L, "attempt to use a closed file");
+	return p->f;
+}
+
+#if defined(LUA_USE_POSIX)
+
+/* number of buffers handled without allocating an 'iovec' array */
+#define IOVECBUFF	16
+
+static int checkfd (lua_State *L, int arg) {
+	lua_Integer fd;
+	FILE *f = tofile(L, arg);
+	if (f) {
+		fflush(f);  /* contents buffered must precede ones transferred */
+		return fileno(f);
+	}
+	fd = luaL_checkinteger(L, arg);
+	luaL_argcheck(L, 0 <= fd && fd <= INT_MAX, arg, "invalid file descriptor");
+	return (int)fd;
+}
+
+/*
+** Transfers bytes between the memory or string at argument 1 and the
+** file or file descriptor at argument 2, from position 'offset' of the
+** file if it is not negative.
+*/
+static int fileio (lua_State *L, int output, lua_Integer offset, int arg) {
+	size_t len, n, i;
+	const char *s = output ? luamem_checkarray(L, 1, &len)
+	                       : checkwritable(L, 1, &len);
+	FILE *f = tofile(L, 2);
+	ssize_t res;
+	i = getrange(L, arg, arg+1, len, &n);
+	if (f && offset < 0) {  /* use stream buffers */
+		clearerr(f);
+		if (output) res = (ssize_t)fwrite(s+i, sizeof(char), n, f);
+		else res = (ssize_t)fread((char *)s+i, sizeof(char), n, f);
+		if (res == 0 && n > 0 && ferror(f)) res = -1;
+	}
+	else {
+		int fd = checkfd(L, 2);
+		do {
+			if (offset < 0) {
+				if (output) res = write(fd, s+i, n);
+				else res = read(fd, (char *)s+i, n);
+			} else {
+				if (output) res = pwrite(fd, s+i, n, (off_t)offset);
+				else res = pread(fd, (char *)s+i, n, (off_t)offset);
+			}
+		} while (res == -1 && errno == EINTR);
+	}
+	if (res == -1) return luaL_fileresult(L, 0, NULL);
+	lua_pushinteger(L, (lua_Integer)res);
+	return 1;
+}
+
+static lua_Integer checkoffset (lua_State *L, int arg) {
+	lua_Integer offset = luaL_checkinteger(L, arg);
+	luaL_argcheck(L, offset >= 0, arg, "invalid offset");
+	return offset;
+}
+
+/*
+** Transfers bytes between the file or file descriptor at argument 1 and
+** the strings or memories that follow, each one optionally followed by
+** the integer positions of the range to be transferred. Entries are
+** filled by 'luamem_toiovec' and then narrowed to the range.
+*/
+static int vectorio (lua_State *L, int output) {
+	struct iovec buff[IOVECBUFF], *iov = buff;
+	int top = lua_gettop(L);
+	int fd = checkfd(L, 1);
+	int arg, n = 0;
+	ssize_t res;
+	if (top-1 > IOVECBUFF)
+		iov = (struct iovec *)lua_newuserdatauv(L, (top-1)*sizeof(struct iovec), 0);
+	for (arg = 2; arg <= top; n++) {
+		int iarg, jarg, none = lua_gettop(L)+1;
+		size_t i, l;
+		if (output) luamem_checkarray(L, arg, NULL);
+		else checkwritable(L, arg, NULL);
+		luamem_toiovec(L, arg, 1, iov+n);
+		iarg = (++arg <= top && lua_type(L, arg) == LUA_TNUMBER) ? arg++ : none;
+		jarg = (iarg != none && arg <= top && lua_type(L, arg) == LUA_TNUMBER) ? arg++ : none;
+		i = getrange(L, iarg, jarg, iov[n].iov_len, &l);
+		iov[n].iov_base = (char *)iov[n].iov_base+i;
+		iov[n].iov_len = l;
+	}
+	do {
+		if (output) res = writev(fd, iov, n);
+		else res = readv(fd, iov, n);
+	} while (res == -1 && errno == EINTR);
+	if (res == -1) return luaL_fileresult(L, 0, NULL);
+	lua_pushinteger(L, (lua_Integer)res);
+	return 1;
+}
+
+static int mem_read (lua_State *L) {
+	return fileio(L, 0, -1, 3);
+}
+
+static int mem_write (lua_State *L) {
+	return fileio(L, 1, -1, 3);
+}
+
+static int mem_pread (lua_State *L) {
+	return fileio(L, 0, checkoffset(L, 3), 4);
+}
+
+static int mem_pwrite (lua_State *L) {
+	return fileio(L, 1, checkoffset(L, 3), 4);
+}
+
+static int mem_readv (lua_State *L) {
+	return vectorio(L, 0);
+}
+
+static int mem_writev (lua_State *L) {
+	return vectorio(L, 1);
+}
+
+#else
+
+static int fileio (lua_State *L, int output) {
+	size_t len, n, i, res;
+	const char *s = output ? luamem_checkarray(L, 1, &len)
+	                       : checkwritable(L, 1, &len);
+	FILE *f = tofile(L, 2);
+	if (f == NULL) return luaL_typeerror(L, 2, LUA_FILEHANDLE);
+	i = getrange(L, 3, 4, len, &n);
+	clearerr(f);
+	if (output) res = fwrite(s+i, sizeof(char), n, f);
+	else res = fread((char *)s+i, sizeof(char), n, f);
+	if (res == 0 && n > 0 && ferror(f)) return luaL_fileresult(L, 0, NULL);
+	lua_pushinteger(L, (lua_Integer)res);
+	return 1;
+}
+
+static int mem_read (lua_State *L) {
+	return fileio(L, 0);
+}
+
+static int mem_write (lua_State *L) {
+	return fileio(L, 1);
+}
+
+static int mem_pread (lua_State *L) {
+	return luaL_error(L, "'pread' not supported");
+}
+
+static int mem_pwrite (lua_State *L) {
+	return luaL_error(L, "'pwrite' not supported");
+}
+
+static int mem_readv (lua_State *L) {
+	return luaL_error(L, "'readv' not supported");
+}
+
+static int mem_writev (lua_State *L) {
+	return luaL_error(L, "'writev' not supported");
+}
+
+#endif
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** MEMORY-MAPPED FILES
+** =======================================================
+*/
+
+#if defined(LUA_USE_POSIX)
+
+static size_t pagedelta (void *mem) {
+	return (size_t)((uintptr_t)mem % (uintptr_t)sysconf(_SC_PAGESIZE));
+}
+
+static void mapunref (lua_State *L, void *mem, size_t len) {
+	size_t delta = pagedelta(mem);
+	(void)L;
+	munmap((char *)mem-delta, len+delta);
+}
+
+/* unmaps files mapped without write access */
+static void romapunref (lua_State *L, void *mem, size_t len) {
+	mapunref(L, mem, len);
+}
+
+#define isromap(u)	((u) == romapunref)
+
+static char *checkmapped (lua_State *L, int arg, size_t *len) {
+	luamem_Unref unref;
+	char *mem = luamem_tomemoryx(L, arg, len, &unref, NULL);
+	luaL_argcheck(L, unref == mapunref || isromap(unref), arg,
+	                 "mapped memory expected");
+	return mem;
+}
+
+static int mem_map (lua_State *L) {
+	static const char *const modes[] = {"r", "w", NULL};
+	const char *path = luaL_checkstring(L, 1);
+	int writable = luaL_checkoption(L, 2, "r", modes);
+	lua_Integer offset = luaL_optinteger(L, 3, 0);
+	lua_Integer length = luaL_optinteger(L, 4, -1);
+	struct stat st;
+	int fd;
+	luaL_argcheck(L, offset >= 0, 3, "offset out of bounds");
+	luaL_argcheck(L, length >= -1, 4, "invalid size");
+	luamem_newref(L);
+	fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		int res = luaL_fileresult(L, 0, path);
+		if (fd != -1) close(fd);
+		return res;
+	}
+	if (offset > (lua_Integer)st.st_size) {
+		close(fd);
+		return luaL_argerror(L, 3, "offset out of bounds");
+	}
+	if (length == -1) length = (lua_Integer)st.st_size-offset;
+	else if (length > (lua_Integer)st.st_size-offset) {
+		close(fd);
+		return luaL_argerror(L, 4, "length out of bounds");
+	}
+	if ((lua_Unsigned)length > MAX_SIZET/2) {
+		close(fd);
+		return luaL_error(L, "file too large");
+	}
+	if (length > 0) {
+		size_t delta = (size_t)(offset % sysconf(_SC_PAGESIZE));
+		size_t len = (size_t)length;
+		char *mem = (char *)mmap(NULL, len+delta,
+		                         writable ? PROT_READ|PROT_WRITE : PROT_READ,
+		                         MAP_SHARED, fd, (off_t)offset-(off_t)delta);
+		if (mem == MAP_FAILED) {
+			int res = luaL_fileresult(L, 0, path);
+			close(fd);
+			return res;
+		}
+		luamem_setref(L, -1, mem+delta, len, writable ? mapunref : romapunref);
+	}
+	close(fd);
+	return 1;
+}
+
+static int mem_sync (lua_State *L) {
+	size_t len;
+	char *mem = checkmapped(L, 1, &len);
+	int flags = lua_toboolean(L, 2) ? MS_ASYNC : MS_SYNC;
+	size_t delta = pagedelta(mem);
+	return luaL_fileresult(L, msync(mem-delta, len+delta, flags) == 0, NULL);
+}
+
+static int mem_advise (lua_State *L) {
+	static const int advices[] = {POSIX_MADV_NORMAL, POSIX_MADV_SEQUENTIAL,
+		POSIX_MADV_RANDOM, POSIX_MADV_WILLNEED, POSIX_MADV_DONTNEED};
+	static const char *const names[] = {"normal", "sequential",
+		"random", "willneed", "dontneed", NULL};
+	size_t len;
+	char *mem = checkmapped(L, 1, &len);
+	int advice = advices[luaL_checkoption(L, 2, NULL, names)];
+	size_t delta = pagedelta(mem);
+	int err = posix_madvise(mem-delta, len+delta, advice);
+	if (err) {
+		errno = err;
+		return luaL_fileresult(L, 0, NULL);
+	}
+	return luaL_fileresult(L, 1, NULL);
+}
+
+#else
+
+static int mem_map (lua_State *L) {
+	return luaL_error(L, "'map' not supported");
+}
+
+static int mem_sync (lua_State *L) {
+	return luaL_error(L, "'sync' not supported");
+}
+
+static int mem_advise (lua_State *L) {
+	return luaL_error(L, "'advise' not supported");
+}
+
+#define isromap(u)	((void)(u), 0)
+
+#endif
+
+/*
+** Checks whether the memory at 'idx' is a file mapped without write
+** access, or a view of one, so its bytes cannot be changed.
+*/
+static int isreadonly (lua_State *L, int idx) {
+	luamem_Unref unref;
+	int type, readonly = 0;
+	luamem_tomemoryx(L, idx, NULL, &unref, &type);
+	if (type != LUAMEM_TREF || unref == luamem_free) return 0;
+	if (isromap(unref)) return 1;
+	if (lua_getiuservalue(L, idx, 1) != LUA_TNONE) {  /* viewed memory? */
+		luamem_tomemoryx(L, -1, NULL, &unref, NULL);
+		readonly = isromap(unref);
+	}
+	lua_pop(L, 1);
+	return readonly;
+}
+
+static char *checkwritable (lua_State *L, int arg, size_t *len) {
+	char *mem = luamem_checkmemory(L, arg, len);
+	luaL_argcheck(L, !isreadonly(L, arg), arg, "read-only memory");
+	return mem;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** SHARED MEMORY
+** =======================================================
+*/
+
+#if defined(LUA_USE_POSIX)
+
+static int shareobject (lua_State *L, const char *name, const char *s,
+                        size_t len) {
+	int fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+	if (fd == -1) return luaL_fileresult(L, 0, name);
+	if (len > 0) {
+		char *mem = MAP_FAILED;
+		if (ftruncate(fd, (off_t)len) == 0)
+			mem = (char *)mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+		if (mem == MAP_FAILED) {
+			int res = luaL_fileresult(L, 0, name);
+			close(fd);
+			shm_unlink(name);
+			return res;
+		}
+		if (s) memcpy(mem, s, len*sizeof(char));
+		munmap(mem, len);
+	}
+	close(fd);
+	lua_pushstring(L, name);
+	return 1;
+}
+
+static int attachobject (lua_State *L, const char *name) {
+	struct stat st;
+	int fd = shm_open(name, O_RDWR, 0);
+	luamem_newref(L);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		int res = luaL_fileresult(L, 0, name);
+		if (fd != -1) close(fd);
+		return res;
+	}
+	if (st.st_size > 0) {
+		size_t len = (size_t)st.st_size;
+		char *mem = (char *)mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED,
+		                         fd, 0);
+		if (mem == MAP_FAILED) {
+			int res = luaL_fileresult(L, 0, name);
+			close(fd);
+			return res;
+		}
+		luamem_setref(L, -1, mem, len, mapunref);
+	}
+	close(fd);
+	return 1;
+}
+
+static int unlinkobject (lua_State *L, const char *name) {
+	return luaL_fileresult(L, shm_unlink(name) == 0, name);
+}
+
+#else
+
+static int noobjects (lua_State *L) {
+	return luaL_error(L, "named shared memory not supported");
+}
+
+#define shareobject(L,n,s,l)	((void)(n), (void)(s), (void)(l), noobjects(L))
+#define attachobject(L,n)	((void)(n), noobjects(L))
+#define unlinkobject(L,n)	((void)(n), noobjects(L))
+
+#endif
+
+/*
+** Handles keep in their user value a memory attached to the shared
+** memory, which holds their reference to it until they are unshared.
+*/
+#define SHAREDHANDLE	"luamem_SharedHandle"
+
+static int mem_share (lua_State *L) {
+	if (!lua_isnoneornil(L, 2)) {
+		size_t len;
+		const char *s = NULL;
+		if (lua_type(L, 1) == LUA_TNUMBER) len = luamem_checklenarg(L, 1);
+		else s = luamem_checkarray(L, 1, &len);
+		return shareobject(L, luaL_checkstring(L, 2), s, len);
+	}
+	lua_newuserdatauv(L, 0, 1);
+	luaL_setmetatable(L, SHAREDHANDLE);
+	luamem_attach(L, luamem_share(L, 1));
+	lua_setiuservalue(L, -2, 1);
+	return 1;
+}
+
+static int mem_attach (lua_State *L) {
+	if (lua_type(L, 1) == LUA_TSTRING)
+		return attachobject(L, lua_tostring(L, 1));
+	luaL_checkudata(L, 1, SHAREDHANDLE);
+	luaL_argcheck(L, lua_getiuservalue(L, 1, 1) != LUA_TNIL, 1,
+	                 "unshared handle");
+	luamem_attach(L, luamem_share(L, -1));
+	return 1;
+}
+
+static int mem_unshare (lua_State *L) {
+	if (lua_type(L, 1) == LUA_TSTRING)
+		return unlinkobject(L, lua_tostring(L, 1));
+	luaL_checkudata(L, 1, SHAREDHANDLE);
+	if (lua_getiuservalue(L, 1, 1) != LUA_TNIL) {
+		luamem_setref(L, -1, NULL, 0, NULL);  /* release the reference */
+		lua_pushnil(L);
+		lua_setiuservalue(L, 1, 1);
+	}
+	return 0;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** ATOMICS
+** =======================================================
+*/
+
+#if defined(ATOMICSUPPORT)
+
+#define ATOMIC	"luamem_Atomic"
+
+/*
+** An atomic refers to an unsigned integer of 4 or 8 bytes at 'offset'
+** of the memory in its user value, which must be aligned to its size
+** whenever it is accessed.
+*/
+typedef struct Atomic {
+	size_t offset;
+	int wide;  /* true for 64-bit integers */
+} Atomic;
+
+#define atomicsize(A)	((A)->wide ? sizeof(uint64_t) : sizeof(uint32_t))
+
+#define isaligned(p,s)	(((uintptr_t)(p) & ((s)-1)) == 0)
+
+static const memory_order orders[] = {memory_order_relaxed,
+	memory_order_acquire, memory_order_release, memory_order_acq_rel,
+	memory_order_seq_cst};
+
+static const char *const ordernames[] = {"relaxed", "acquire", "release",
+	"acq_rel", "seq_cst", NULL};
+
+/* kinds of operations, which cannot use some orders */
+#define OPLOAD	1
+#define OPSTORE	2
+#define OPRMW	3
+
+static memory_order checkorder (lua_State *L, int arg, int op) {
+	memory_order order = orders[luaL_checkoption(L, arg, "seq_cst", ordernames)];
+	luaL_argcheck(L, op == OPRMW || order == memory_order_relaxed ||
+	                 order == memory_order_seq_cst ||
+	                 order == (op == OPLOAD ? memory_order_acquire
+	                                        : memory_order_release),
+	                 arg, "invalid order for operation");
+	return order;
+}
+
+/* order used when a compare-and-swap fails, which does not store */
+static memory_order failorder (memory_order order) {
+	if (order == memory_order_release) return memory_order_relaxed;
+	if (order == memory_order_acq_rel) return memory_order_acquire;
+	return order;
+}
+
+static void *checkatomic (lua_State *L, Atomic **pA) {
+	Atomic *A = (Atomic *)luaL_checkudata(L, 1, ATOMIC);
+	size_t len, size = atomicsize(A);
+	char *p;
+	lua_getiuservalue(L, 1, 1);
+	p = luamem_tomemory(L, -1, &len);
+	lua_pop(L, 1);  /* memory is kept by the atomic */
+	luaL_argcheck(L, A->offset <= len && size <= len - A->offset, 1,
+	              "atomic beyond memory");
+	p += A->offset;
+	luaL_argcheck(L, isaligned(p, size), 1, "unaligned atomic");
+	*pA = A;
+	return p;
+}
+
+/* gets an operand which wraps around */
+static uint64_t checkoperand (lua_State *L, int arg, const Atomic *A) {
+	lua_Integer v = luaL_checkinteger(L, arg);
+	return A->wide ? (uint64_t)v : (uint32_t)v;
+}
+
+/* gets a value to be stored, which must fit in the integer */
+static uint64_t checkvalue (lua_State *L, int arg, const Atomic *A) {
+	lua_Integer v = luaL_checkinteger(L, arg);
+	if (A->wide) return (uint64_t)v;  /* 64-bit integers wrap around */
+	luaL_argcheck(L, 0 <= v && v <= (lua_Integer)UINT32_MAX, arg,
+	              "value out of range");
+	return (uint64_t)v;
+}
+
+static int mem_atomic (lua_State *L) {
+	static const char *const types[] = {"u32", "u64", NULL};
+	size_t len, i, size;
+	char *p = checkwritable(L, 1, &len);
+	int wide = luaL_checkoption(L, 3, NULL, types);
+	Atomic *A;
+	size = wide ? sizeof(uint64_t) : sizeof(uint32_t);
+	i = posrelatI(luaL_checkinteger(L, 2), len) - 1;
+	luaL_argcheck(L, i <= len && size <= len - i, 2, "index out of bounds");
+	luaL_argcheck(L, isaligned(p + i, size), 2, "unaligned atomic");
+	A = (Atomic *)lua_newuserdatauv(L, sizeof(Atomic), 1);
+	A->offset = i;
+	A->wide = wide;
+	luaL_setmetatable(L, ATOMIC);
+	lua_pushvalue(L, 1);
+	lua_setiuservalue(L, -2, 1);  /* keep memory */
+	return 1;
+}
+
+static int atom_load (lua_State *L) {
+	Atomic *A;
+	void *p = checkatomic(L, &A);
+	memory_order order = checkorder(L, 2, OPLOAD);
+	if (A->wide)
+		lua_pushinteger(L, (lua_Integer)atomic_load_explicit(
+			(_Atomic uint64_t *)p, order));
+	else
+		lua_pushinteger(L, (lua_Integer)atomic_load_explicit(
+			(_Atomic uint32_t *)p, order));
+	return 1;
+}
+
+static int atom_store (lua_State *L) {
+	Atomic *A;
+	void *p = checkatomic(L, &A);
+	uint64_t v = checkvalue(L, 2, A);
+	memory_order order = checkorder(L, 3, OPSTORE);
+	if (A->wide) atomic_store_explicit((_Atomic uint64_t *)p, v, order);
+	else atomic_store_explicit((_Atomic uint32_t *)p, (uint32_t)v, order);
+	return 0;
+}
+
+static int atom_exchange (lua_State *L) {
+	Atomic *A;
+	void *p = checkatomic(L, &A);
+	uint64_t v = checkvalue(L, 2, A);
+	memory_order order = checkorder(L, 3, OPRMW);
+	if (A->wide)
+		lua_pushinteger(L, (lua_Integer)atomic_exchange_explicit(
+			(_Atomic uint64_t *)p, v, order));
+	else
+		lua_pushinteger(L, (lua_Integer)atomic_exchange_explicit(
+			(_Atomic uint32_t *)p, (uint32_t)v, order));
+	return 1;
+}
+
+static int fetchop (lua_State *L, int sub) {
+	Atomic *A;
+	void *p = checkatomic(L, &A);
+	uint64_t v = checkoperand(L, 2, A);
+	memory_order order = checkorder(L, 3, OPRMW);
+	uint64_t old;
+	if (A->wide) {
+		_Atomic uint64_t *a = (_Atomic uint64_t *)p;
+		old = sub ? atomic_fetch_sub_explicit(a, v, order)
+		          : atomic_fetch_add_explicit(a, v, order);
 	}
-	return 2;
+	else {
+		_Atomic uint32_t *a = (_Atomic uint32_t *)p;
+		old = sub ? atomic_fetch_sub_explicit(a, (uint32_t)v, order)
+		          : atomic_fetch_add_explicit(a, (uint32_t)v, order);
+	}
+	lua_pushinteger(L, (lua_Integer)old);
+	return 1;
 }
 
-static int mem_get (lua_State *L) {
-	size_t len;
-	const char *s = luamem_checkmemory(L, 1, &len);
-	return str2byte(L, s, len);
+static int atom_add (lua_State *L) {
+	return fetchop(L, 0);
 }
 
-static int mem_set (lua_State *L) {
-	size_t len;
-	size_t n = lua_gettop(L)-2;  /* number of bytes */
-	char *p = luamem_checkmemory(L, 1, &len);
-	size_t i = posrelatI(luaL_checkinteger(L, 2), len);
-	luaL_argcheck(L, 1 <= i && i <= len, 2, "index out of bounds");
-	len = 1+len-i;
-	code2char(L, 3, p+i-1, n < len ? n : len);
-	return 0;
+static int atom_sub (lua_State *L) {
+	return fetchop(L, 1);
 }
 
-static int mem_find (lua_State *L) {
-	size_t len, sl;
-	const char *p = luamem_checkarray(L, 1, &len);
-	const char *s = luamem_checkarray(L, 2, &sl);
-	size_t i = posrelatI(luaL_optinteger(L, 3, 1), len);
-	size_t j = getendpos(L, 4, -1, len);
-	size_t os = posrelatI(luaL_optinteger(L, 5, 1), sl);
-	if (i <= j && os <= sl) {
-		size_t n = j-i+1;
-		if (i+n <= j)  /* arithmetic overflow? */
-			return luaL_error(L, "string slice too long");
-		os--;
-		sl -= os;
-		s = lmemfind(p+i-1, n, s+os, sl < n ? sl : n);
-		if (s) {
-			lua_pushinteger(L, (s-p)+1);
-			lua_pushinteger(L, (s-p)+sl);
-			return 2;
-		}
+static int atom_cas (lua_State *L) {
+	Atomic *A;
+	void *p = checkatomic(L, &A);
+	uint64_t expected = checkvalue(L, 2, A);
+	uint64_t desired = checkvalue(L, 3, A);
+	memory_order order = checkorder(L, 4, OPRMW);
+	int done;
+	if (A->wide) {
+		done = atomic_compare_exchange_strong_explicit((_Atomic uint64_t *)p,
+			&expected, desired, order, failorder(order));
 	}
-	return 0;
+	else {
+		uint32_t e = (uint32_t)expected;
+		done = atomic_compare_exchange_strong_explicit((_Atomic uint32_t *)p,
+			&e, (uint32_t)desired, order, failorder(order));
+		expected = e;
+	}
+	lua_pushboolean(L, done);
+	lua_pushinteger(L, (lua_Integer)expected);  /* previous value */
+	return 2;
 }
 
-static int mem_fill (lua_State *L) {
-	size_t len, sl;
-	char *p = luamem_checkmemory(L, 1, &len);
-	size_t i = posrelatI(luaL_optinteger(L, 3, 1), len);
-	size_t j = getendpos(L, 4, -1, len);
-	char c;
-	const char *s = NULL;
-	size_t os;
-	if (lua_type(L, 2) == LUA_TNUMBER) {
-		s = &c;
-		sl = 1;
-		os = 1;
-		code2char(L, 2, &c, 1);
-	} else {
-		s = luamem_checkarray(L, 2, &sl);
-		os = posrelatI(luaL_optinteger(L, 5, 1), sl);
-	}
-	if (i <= j && os <= sl) {
-		os--;
-		memfill(p+i-1, j-i+1, s+os, sl-os);
-	}
-	return 0;
+static const luaL_Reg atomiclib[] = {
+	{"load", atom_load},
+	{"store", atom_store},
+	{"exchange", atom_exchange},
+	{"add", atom_add},
+	{"sub", atom_sub},
+	{"cas", atom_cas},
+	{NULL, NULL}
+};
+
+static void createatomicmeta (lua_State *L) {
+	luaL_newmetatable(L, ATOMIC);
+	luaL_newlib(L, atomiclib);
+	lua_setfield(L, -2, "__index");  /* metatable.__index = atomic methods */
+	lua_pop(L, 1);  /* pop metatable */
 }
 
-static int mem_concat (lua_State *L) {
-	size_t l1, l2;
-	const char *s1 = luamem_toarray(L, 1, &l1);
-	const char *s2 = luamem_toarray(L, 2, &l2);
-	if (s1 && s2) {
-		luaL_Buffer B;
-		char *buff = luaL_buffinitsize(L, &B, l1+l2);
-		memcpy(buff, s1, l1*sizeof(char));
-		memcpy(buff+l1, s2, l2*sizeof(char));
-		luaL_addsize(&B, l1+l2);
-		luaL_pushresult(&B);
-	} else {
-		if (l_unlikely(luamem_ismemory(L, 2) ||
-			             !luaL_getmetafield(L, 2, "__concat")))
-			luaL_error(L, "attempt to concat a '%s' with a '%s'",
-			              luaL_typename(L, 1), luaL_typename(L, 2));
-		lua_insert(L, -3);  /* put metamethod before arguments */
-		lua_call(L, 2, 1);  /* call metamethod */
-	}
-	return 1;
+#else
+
+static int mem_atomic (lua_State *L) {
+	return luaL_error(L, "'atomic' not supported");
 }
 
-static int mem_pack (lua_State *L);
-static int mem_unpack (lua_State *L);
+#define createatomicmeta(L)	((void)0)
+
+#endif
+
+/* }====================================================== */
 
 static const luaL_Reg lib[] = {
 	{"create", mem_create},
+	{"view", mem_view},
+	{"ring", mem_ring},
+	{"produce", mem_produce},
+	{"consume", mem_consume},
+	{"read", mem_read},
+	{"write", mem_write},
+	{"pread", mem_pread},
+	{"pwrite", mem_pwrite},
+	{"readv", mem_readv},
+	{"writev", mem_writev},
+	{"map", mem_map},
+	{"sync", mem_sync},
+	{"advise", mem_advise},
+	{"share", mem_share},
+	{"attach", mem_attach},
+	{"unshare", mem_unshare},
+	{"atomic", mem_atomic},
 	{"type", mem_type},
 	{"resize", mem_resize},
+	{"reserve", mem_reserve},
+	{"shrink", mem_shrink},
+	{"capacity", mem_capacity},
 	{"len", mem_len},
 	{"diff", mem_diff},
+	{"compare", mem_compare},
 	{"find", mem_find},
+	{"rfind", mem_rfind},
+	{"findall", mem_findall},
+	{"split", mem_split},
+	{"findbyte", mem_findbyte},
+	{"skipbytes", mem_skipbytes},
+	{"findpattern", mem_findpattern},
+	{"match", mem_match},
+	{"gmatch", mem_gmatch},
+	{"searcher", mem_searcher},
 	{"fill", mem_fill},
+	{"band", mem_band},
+	{"bor", mem_bor},
+	{"bxor", mem_bxor},
+	{"bnot", mem_bnot},
+	{"rep", mem_rep},
 	{"get", mem_get},
 	{"set", mem_set},
+	{"totable", mem_totable},
+	{"fromtable", mem_fromtable},
 	{"pack", mem_pack},
 	{"unpack", mem_unpack},
+	{"layout", mem_layout},
+	{"builder", mem_builder},
+	{"array", mem_array},
+	{"crc32", mem_crc32},
+	{"crc32c", mem_crc32c},
+	{"xxhash64", mem_xxhash64},
+	{"xxhash64state", mem_xxhash64state},
+	{"encode", mem_encode},
+	{"decode", mem_decode},
+	{"encodelen", mem_encodelen},
+	{"decodelen", mem_decodelen},
 	{"tostring", mem_tostring},
+	{"freeze", mem_freeze},
+	{NULL, NULL}
+};
+
+static const luaL_Reg layoutlib[] = {
+	{"pack", layout_pack},
+	{"unpack", layout_unpack},
+	{"packsize", layout_packsize},
+	{NULL, NULL}
+};
+
+static const luaL_Reg builderlib[] = {
+	{"pack", builder_pack},
+	{"add", builder_add},
+	{"addint", builder_addint},
+	{"adddouble", builder_adddouble},
+	{"memory", builder_memory},
+	{NULL, NULL}
+};
+
+static const luaL_Reg buildermeta[] = {
+	{"__len", builder_len},
+	{"__tostring", builder_tostring},
+	{NULL, NULL}
+};
+
+static const luaL_Reg arraylib[] = {
+	{"sum", array_sum},
+	{"min", array_min},
+	{"max", array_max},
+	{"scale", array_scale},
+	{"add", array_add},
+	{"dot", array_dot},
+	{NULL, NULL}
+};
+
+static const luaL_Reg arraymeta[] = {
+	{"__newindex", array_newindex},
+	{"__len", array_len},
+	{NULL, NULL}
+};
+
+static const luaL_Reg searcherlib[] = {
+	{"find", searcher_find},
+	{"rfind", searcher_rfind},
+	{"findall", searcher_findall},
 	{NULL, NULL}
 };
 
@@ -234,6 +3051,9 @@ static const luaL_Reg meta[] = {
 	{"__len", mem_len},
 	{"__concat", mem_concat},
 	{"__tostring", mem_tostring},
+	{"__eq", mem_eq},
+	{"__lt", mem_lt},
+	{"__le", mem_le},
 	{NULL, NULL}
 };
 
@@ -255,6 +3075,33 @@ LUAMEMMOD_API int luaopen_memory (lua_State *L) {
 	setupmetatable(L);
 	luamem_newref(L);
 	setupmetatable(L);
+	luamem_newlayout(L, "");
+	lua_getmetatable(L, -1);
+	luaL_newlib(L, layoutlib);
+	lua_setfield(L, -2, "__index");  /* metatable.__index = layout methods */
+	lua_pop(L, 2);  /* pop metatable and layout */
+	luaL_newmetatable(L, SEARCHER);
+	lua_pushcfunction(L, searcher_len);
+	lua_setfield(L, -2, "__len");
+	luaL_newlib(L, searcherlib);
+	lua_setfield(L, -2, "__index");  /* metatable.__index = searcher methods */
+	lua_pop(L, 1);  /* pop metatable */
+	luaL_newmetatable(L, ARRAY);
+	luaL_setfuncs(L, arraymeta, 0);
+	luaL_newlib(L, arraylib);
+	lua_pushcclosure(L, array_index, 1);
+	lua_setfield(L, -2, "__index");  /* elements or array methods */
+	lua_pop(L, 1);  /* pop metatable */
+	luaL_newmetatable(L, XXH64STATE);
+	lua_pop(L, 1);  /* pop metatable */
+	luaL_newmetatable(L, BUILDER);
+	luaL_setfuncs(L, buildermeta, 0);
+	luaL_newlib(L, builderlib);
+	lua_setfield(L, -2, "__index");  /* metatable.__index = builder methods */
+	lua_pop(L, 1);  /* pop metatable */
+	luaL_newmetatable(L, SHAREDHANDLE);
+	lua_pop(L, 1);  /* pop metatable */
+	createatomicmeta(L);
 	return 1;
 }
 
@@ -370,468 +3217,522 @@ static const char *lmemfind (const char *s1, size_t l1,
 	}
 }
 
+
 /*
 ** {======================================================
-** PACK/UNPACK
+** PATTERN MATCHING
 ** =======================================================
 */
 
-/* value used for padding */
-#if !defined(LUAL_PACKPADBYTE)
-#define LUAL_PACKPADBYTE		0x00
-#endif
-
-/* maximum size for the binary representation of an integer */
-#define MAXINTSIZE	16
-
-/* number of bits in a character */
-#define NB	CHAR_BIT
 
-/* mask for one character (NB 1's) */
-#define MC	((1 << NB) - 1)
+#if !defined(LUA_MAXCAPTURES)
+#define LUA_MAXCAPTURES		32
+#endif
 
-/* size of a lua_Integer */
-#define SZINT	((int)sizeof(lua_Integer))
+#define CAP_UNFINISHED	(-1)
+#define CAP_POSITION	(-2)
 
 
-/* dummy union to get native endianness */
-static const union {
-	int dummy;
-	char little;  /* true iff machine is little endian */
-} nativeendian = {1};
+typedef struct MatchState {
+	const char *src_init;  /* init of source string */
+	const char *src_end;  /* end of source string (not followed by '\0') */
+	const char *p_end;  /* end ('\0') of pattern */
+	lua_State *L;
+	int matchdepth;  /* control for recursive depth (to avoid C stack overflow) */
+	int positions;  /* push captures as positions instead of strings */
+	unsigned char level;  /* total number of captures (finished or unfinished) */
+	struct {
+		const char *init;
+		ptrdiff_t len;
+	} capture[LUA_MAXCAPTURES];
+} MatchState;
 
 
-/* dummy structure to get native alignment requirements */
-struct cD {
-	char c;
-	union { double d; void *p; lua_Integer i; lua_Number n; } u;
-};
+/* recursive function */
+static const char *match (MatchState *ms, const char *s, const char *p);
 
-#define MAXALIGN	(offsetof(struct cD, u))
 
+/* maximum recursion depth for 'match' */
+#if !defined(MAXCCALLS)
+#define MAXCCALLS	200
+#endif
 
-/*
-** Union for serializing floats
-*/
-typedef union Ftypes {
-	float f;
-	double d;
-	lua_Number n;
-	char buff[5 * sizeof(lua_Number)];  /* enough for any float type */
-} Ftypes;
 
+#define L_ESC		'%'
+#define SPECIALS	"^$*+?.([%-"
 
-/*
-** information to pack/unpack stuff
-*/
-typedef struct Header {
-	lua_State *L;
-	int islittle;
-	int maxalign;
-} Header;
 
+static int check_capture (MatchState *ms, int l) {
+	l -= '1';
+	if (l_unlikely(l < 0 || l >= ms->level ||
+	               ms->capture[l].len == CAP_UNFINISHED))
+		return luaL_error(ms->L, "invalid capture index %%%d", l + 1);
+	return l;
+}
 
-/*
-** options for pack/unpack
-*/
-typedef enum KOption {
-	Kint,		/* signed integers */
-	Kuint,	/* unsigned integers */
-	Kfloat,	/* floating-point numbers */
-	Kchar,	/* fixed-length strings */
-	Kstring,	/* strings with prefixed length */
-	Kzstr,	/* zero-terminated strings */
-	Kpadding,	/* padding */
-	Kpaddalign,	/* padding for alignment */
-	Knop		/* no-op (configuration or spaces) */
-} KOption;
 
+static int capture_to_close (MatchState *ms) {
+	int level = ms->level;
+	for (level--; level>=0; level--)
+		if (ms->capture[level].len == CAP_UNFINISHED) return level;
+	return luaL_error(ms->L, "invalid pattern capture");
+}
 
-/*
-** Read an integer numeral from string 'fmt' or return 'df' if
-** there is no numeral
-*/
-static int digit (int c) { return '0' <= c && c <= '9'; }
 
-static int getnum (const char **fmt, int df) {
-	if (!digit(**fmt))  /* no number? */
-		return df;  /* return default value */
-	else {
-		int a = 0;
-		do {
-			a = a*10 + (*((*fmt)++) - '0');
-		} while (digit(**fmt) && a <= ((int)LUAMEM_MAXSIZE - 9)/10);
-		return a;
+static const char *classEnd (MatchState *ms, const char *p) {
+	switch (*p++) {
+		case L_ESC: {
+			if (l_unlikely(p == ms->p_end))
+				luaL_error(ms->L, "malformed pattern (ends with '%%')");
+			return p+1;
+		}
+		case '[': {
+			if (*p == '^') p++;
+			do {  /* look for a ']' */
+				if (l_unlikely(p == ms->p_end))
+					luaL_error(ms->L, "malformed pattern (missing ']')");
+				if (*(p++) == L_ESC && p < ms->p_end)
+					p++;  /* skip escapes (e.g. '%]') */
+			} while (*p != ']');
+			return p+1;
+		}
+		default: {
+			return p;
+		}
 	}
 }
 
 
-/*
-** Read an integer numeral and raises an error if it is larger
-** than the maximum size for integers.
-*/
-static int getnumlimit (Header *h, const char **fmt, int df) {
-	int sz = getnum(fmt, df);
-	if (sz > MAXINTSIZE || sz <= 0)
-		return luaL_error(h->L, "integral size (%d) out of limits [1,%d]",
-		                        sz, MAXINTSIZE);
-	return sz;
+static int match_class (int c, int cl) {
+	int res;
+	switch (tolower(cl)) {
+		case 'a' : res = isalpha(c); break;
+		case 'c' : res = iscntrl(c); break;
+		case 'd' : res = isdigit(c); break;
+		case 'g' : res = isgraph(c); break;
+		case 'l' : res = islower(c); break;
+		case 'p' : res = ispunct(c); break;
+		case 's' : res = isspace(c); break;
+		case 'u' : res = isupper(c); break;
+		case 'w' : res = isalnum(c); break;
+		case 'x' : res = isxdigit(c); break;
+		default: return (cl == c);
+	}
+	if (isupper(cl)) res = !res;
+	return res;
 }
 
 
-/*
-** Initialize Header
-*/
-static void initheader (lua_State *L, Header *h) {
-	h->L = L;
-	h->islittle = nativeendian.little;
-	h->maxalign = 1;
+static int matchbracketclass (int c, const char *p, const char *ec) {
+	int sig = 1;
+	if (*(p+1) == '^') {
+		sig = 0;
+		p++;  /* skip the '^' */
+	}
+	while (++p < ec) {
+		if (*p == L_ESC) {
+			p++;
+			if (match_class(c, uchar(*p)))
+				return sig;
+		}
+		else if (*(p+1) == '-' && (p+2 < ec)) {
+			p+=2;
+			if (uchar(*(p-2)) <= c && c <= uchar(*p))
+				return sig;
+		}
+		else if (uchar(*p) == c) return sig;
+	}
+	return !sig;
 }
 
 
-/*
-** Read and classify next option. 'size' is filled with option's size.
-*/
-static KOption getoption (Header *h, const char **fmt, int *size) {
-	int opt = *((*fmt)++);
-	*size = 0;  /* default */
-	switch (opt) {
-		case 'b': *size = sizeof(char); return Kint;
-		case 'B': *size = sizeof(char); return Kuint;
-		case 'h': *size = sizeof(short); return Kint;
-		case 'H': *size = sizeof(short); return Kuint;
-		case 'l': *size = sizeof(long); return Kint;
-		case 'L': *size = sizeof(long); return Kuint;
-		case 'j': *size = sizeof(lua_Integer); return Kint;
-		case 'J': *size = sizeof(lua_Integer); return Kuint;
-		case 'T': *size = sizeof(size_t); return Kuint;
-		case 'f': *size = sizeof(float); return Kfloat;
-		case 'd': *size = sizeof(double); return Kfloat;
-		case 'n': *size = sizeof(lua_Number); return Kfloat;
-		case 'i': *size = getnumlimit(h, fmt, sizeof(int)); return Kint;
-		case 'I': *size = getnumlimit(h, fmt, sizeof(int)); return Kuint;
-		case 's': *size = getnumlimit(h, fmt, sizeof(size_t)); return Kstring;
-		case 'c':
-			*size = getnum(fmt, -1);
-			if (*size == -1)
-				luaL_error(h->L, "missing size for format option 'c'");
-			return Kchar;
-		case 'z': return Kzstr;
-		case 'x': *size = 1; return Kpadding;
-		case 'X': return Kpaddalign;
-		case ' ': break;
-		case '<': h->islittle = 1; break;
-		case '>': h->islittle = 0; break;
-		case '=': h->islittle = nativeendian.little; break;
-		case '!': h->maxalign = getnumlimit(h, fmt, MAXALIGN); break;
-		default: luaL_error(h->L, "invalid format option '%c'", opt);
+static int singlematch (MatchState *ms, const char *s, const char *p,
+                        const char *ep) {
+	if (s >= ms->src_end)
+		return 0;
+	else {
+		int c = uchar(*s);
+		switch (*p) {
+			case '.': return 1;  /* matches any char */
+			case L_ESC: return match_class(c, uchar(*(p+1)));
+			case '[': return matchbracketclass(c, p, ep-1);
+			default:  return (uchar(*p) == c);
+		}
 	}
-	return Knop;
 }
 
 
-/*
-** Read, classify, and fill other details about the next option.
-** 'psize' is filled with option's size, 'notoalign' with its
-** alignment requirements.
-** Local variable 'size' gets the size to be aligned. (Kpadal option
-** always gets its full alignment, other options are limited by
-** the maximum alignment ('maxalign'). Kchar option needs no alignment
-** despite its size.
-*/
-static KOption getdetails (Header *h, size_t totalsize,
-                           const char **fmt, int *psize, int *ntoalign) {
-	KOption opt = getoption(h, fmt, psize);
-	int align = *psize;  /* usually, alignment follows size */
-	if (opt == Kpaddalign) {  /* 'X' gets alignment from following option */
-		if (**fmt == '\0' || getoption(h, fmt, &align) == Kchar || align == 0)
-			luaL_argerror(h->L, 1, "invalid next option for option 'X'");
-	}
-	if (align <= 1 || opt == Kchar)  /* need no alignment? */
-		*ntoalign = 0;
+static const char *matchbalance (MatchState *ms, const char *s,
+                                   const char *p) {
+	if (l_unlikely(p >= ms->p_end - 1))
+		luaL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
+	if (s >= ms->src_end || *s != *p) return NULL;  /* memory has no '\0' */
 	else {
-		if (align > h->maxalign)  /* enforce maximum alignment */
-			align = h->maxalign;
-		if ((align & (align - 1)) != 0)  /* is 'align' not a power of 2? */
-			luaL_argerror(h->L, 1, "format asks for alignment not power of 2");
-		*ntoalign = (align - (int)(totalsize & (align - 1))) & (align - 1);
+		int b = *p;
+		int e = *(p+1);
+		int cont = 1;
+		while (++s < ms->src_end) {
+			if (*s == e) {
+				if (--cont == 0) return s+1;
+			}
+			else if (*s == b) cont++;
+		}
 	}
-	return opt;
+	return NULL;  /* string ends out of balance */
 }
 
 
-static char *getbytes (char **b, size_t *i, size_t lb, size_t sz) {
-	size_t newtotal = *i+sz;
-	if (newtotal<=lb) {
-		char *res = *b;
-		*b += sz;
-		*i = newtotal;
-		return res;
+static const char *max_expand (MatchState *ms, const char *s,
+                                 const char *p, const char *ep) {
+	ptrdiff_t i = 0;  /* counts maximum expand for item */
+	while (singlematch(ms, s + i, p, ep))
+		i++;
+	/* keeps trying to match with the maximum repetitions */
+	while (i>=0) {
+		const char *res = match(ms, (s+i), ep+1);
+		if (res) return res;
+		i--;  /* else didn't match; reduce 1 repetition to try again */
 	}
 	return NULL;
 }
 
-static int packfailed (lua_State *L, size_t i, size_t arg) {
-	lua_pushboolean(L, 0);
-	lua_replace(L, arg-2);
-	lua_pushinteger(L, i+1);
-	lua_replace(L, arg-1);
-	return 3+lua_gettop(L)-arg;
-}
 
-static int packchar (char **b, size_t *i, size_t lb, const char c) {
-	if (*i<lb) {
-		(void)(*i)++;
-		*((*b)++) = c;
-		return 1;
+static const char *min_expand (MatchState *ms, const char *s,
+                                 const char *p, const char *ep) {
+	for (;;) {
+		const char *res = match(ms, s, ep+1);
+		if (res != NULL)
+			return res;
+		else if (singlematch(ms, s, p, ep))
+			s++;  /* try with one more repetition */
+		else return NULL;
 	}
-	return 0;
 }
 
-static int packstream (char **b, size_t *i, size_t lb,
-                       const char *s, size_t sl) {
-	if (sl > 0) {  /* avoid 'memcpy' when 's' can be NULL */
-		char *d = getbytes(b, i, lb, sl);
-		if (d == NULL) return 0;
-		memcpy(d, s, sl * sizeof(char));
-	}
-	return 1;
+
+static const char *start_capture (MatchState *ms, const char *s,
+                                    const char *p, int what) {
+	const char *res;
+	int level = ms->level;
+	if (level >= LUA_MAXCAPTURES) luaL_error(ms->L, "too many captures");
+	ms->capture[level].init = s;
+	ms->capture[level].len = what;
+	ms->level = level+1;
+	if ((res=match(ms, s, p)) == NULL)  /* match failed? */
+		ms->level--;  /* undo capture */
+	return res;
 }
 
 
-/*
-** Pack integer 'n' with 'size' bytes and 'islittle' endianness.
-** The final 'if' handles the case when 'size' is larger than
-** the size of a Lua integer, correcting the extra sign-extension
-** bytes if necessary (by default they would be zeros).
-*/
-static int packint (char **b, size_t *pos, size_t lb,
-                    lua_Unsigned n, int islittle, int size, int neg) {
-	char *buff = getbytes(b, pos, lb, size);
-	if (buff) {
-		int i;
-		buff[islittle ? 0 : size - 1] = (char)(n & MC);  /* first byte */
-		for (i = 1; i < size; i++) {
-			n >>= NB;
-			buff[islittle ? i : size - 1 - i] = (char)(n & MC);
-		}
-		if (neg && size > SZINT) {  /* negative number need sign extension? */
-			for (i = SZINT; i < size; i++)  /* correct extra bytes */
-				buff[islittle ? i : size - 1 - i] = (char)MC;
-		}
-		return 1;
-	}
-	return 0;
+static const char *end_capture (MatchState *ms, const char *s,
+                                  const char *p) {
+	int l = capture_to_close(ms);
+	const char *res;
+	ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+	if ((res = match(ms, s, p)) == NULL)  /* match failed? */
+		ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+	return res;
 }
 
 
-/*
-** Copy 'size' bytes from 'src' to 'dest', correcting endianness if
-** given 'islittle' is different from native endianness.
-*/
-static void copywithendian (volatile char *dest, volatile const char *src,
-                            int size, int islittle) {
-	if (islittle == nativeendian.little) {
-		while (size-- != 0)
-			*(dest++) = *(src++);
-	}
-	else {
-		dest += size - 1;
-		while (size-- != 0)
-			*(dest--) = *(src++);
-	}
+static const char *match_capture (MatchState *ms, const char *s, int l) {
+	size_t len;
+	l = check_capture(ms, l);
+	len = ms->capture[l].len;
+	if ((size_t)(ms->src_end-s) >= len &&
+	    memcmp(ms->capture[l].init, s, len) == 0)
+		return s+len;
+	else return NULL;
 }
 
-static int mem_pack (lua_State *L) {
-	Header h;
-	size_t lb;
-	char *mem = luamem_checkmemory(L, 1, &lb);
-	const char *fmt = luaL_checkstring(L, 2);  /* format string */
-	size_t i = posrelatI(luaL_checkinteger(L, 3), lb) - 1;
-	int arg = 3;  /* current argument to pack */
-	luaL_argcheck(L, i <= lb, 3, "index out of bounds");
-	initheader(L, &h);
-	mem += i;
-	while (*fmt != '\0') {
-		int size, ntoalign;
-		KOption opt = getdetails(&h, i, &fmt, &size, &ntoalign);
-		arg++;
-		if (!getbytes(&mem, &i, lb, ntoalign))  /* skip alignment */
-			return packfailed(L, i, arg);
-		switch (opt) {
-			case Kint: {  /* signed integers */
-				lua_Integer n = luaL_checkinteger(L, arg);
-				if (size < SZINT) {  /* need overflow check? */
-					lua_Integer lim = (lua_Integer)1 << ((size * NB) - 1);
-					luaL_argcheck(L, -lim <= n && n < lim, arg, "integer overflow");
-				}
-				if (!packint(&mem, &i, lb, (lua_Unsigned)n, h.islittle, size, (n < 0)))
-					return packfailed(L, i, arg);
-				break;
-			}
-			case Kuint: {  /* unsigned integers */
-				lua_Integer n = luaL_checkinteger(L, arg);
-				if (size < SZINT)  /* need overflow check? */
-					luaL_argcheck(L, (lua_Unsigned)n < ((lua_Unsigned)1 << (size * NB)),
-					                 arg, "unsigned overflow");
-				if (!packint(&mem, &i, lb, (lua_Unsigned)n, h.islittle, size, 0))
-					return packfailed(L, i, arg);
+
+static const char *match (MatchState *ms, const char *s, const char *p) {
+	if (l_unlikely(ms->matchdepth-- == 0))
+		luaL_error(ms->L, "pattern too complex");
+	init: /* using goto's to optimize tail recursion */
+	if (p != ms->p_end) {  /* end of pattern? */
+		switch (*p) {
+			case '(': {  /* start capture */
+				if (*(p + 1) == ')')  /* position capture? */
+					s = start_capture(ms, s, p + 2, CAP_POSITION);
+				else
+					s = start_capture(ms, s, p + 1, CAP_UNFINISHED);
 				break;
 			}
-			case Kfloat: {  /* floating-point options */
-				volatile Ftypes u;
-				lua_Number n;
-				char *data = getbytes(&mem, &i, lb, size);
-				if (!data) return packfailed(L, i, arg);
-				n = luaL_checknumber(L, arg);  /* get argument */
-				if (size == sizeof(u.f)) u.f = (float)n;  /* copy it into 'u' */
-				else if (size == sizeof(u.d)) u.d = (double)n;
-				else u.n = n;
-				/* move 'u' to final result, correcting endianness if needed */
-				copywithendian(data, u.buff, size, h.islittle);
+			case ')': {  /* end capture */
+				s = end_capture(ms, s, p + 1);
 				break;
 			}
-			case Kchar: {  /* fixed-size string */
-				size_t len;
-				const char *s = luamem_checkarray(L, arg, &len);
-				luaL_argcheck(L, len == (size_t)size, arg, "wrong length");
-				if (!packstream(&mem, &i, lb, s, size))
-					return packfailed(L, i, arg);
+			case '$': {
+				if ((p + 1) != ms->p_end)  /* is the '$' the last char in pattern? */
+					goto dflt;  /* no; go to default */
+				s = (s == ms->src_end) ? s : NULL;  /* check end of string */
 				break;
 			}
-			case Kstring: {  /* strings with length count */
-				size_t len;
-				const char *s = luamem_checkarray(L, arg, &len);
-				luaL_argcheck(L, size >= (int)sizeof(size_t) ||
-				                 len < ((size_t)1 << (size * NB)),
-				                 arg, "string length does not fit in given size");
-				if (!packint(&mem, &i, lb, (lua_Unsigned)len, h.islittle, size, 0) ||  /* pack length */
-				    !packstream(&mem, &i, lb, s, len))
-					return packfailed(L, i, arg);
+			case L_ESC: {  /* escaped sequences not in the format class[*+?-]? */
+				switch (*(p + 1)) {
+					case 'b': {  /* balanced string? */
+						s = matchbalance(ms, s, p + 2);
+						if (s != NULL) {
+							p += 4; goto init;  /* return match(ms, s, p + 4); */
+						}  /* else fail (s == NULL) */
+						break;
+					}
+					case 'f': {  /* frontier? */
+						const char *ep; char previous, current;
+						p += 2;
+						if (l_unlikely(*p != '['))
+							luaL_error(ms->L, "missing '[' after '%%f' in pattern");
+						ep = classEnd(ms, p);  /* points to what is next */
+						previous = (s == ms->src_init) ? '\0' : *(s - 1);
+						current = (s == ms->src_end) ? '\0' : *s;
+						if (!matchbracketclass(uchar(previous), p, ep - 1) &&
+						     matchbracketclass(uchar(current), p, ep - 1)) {
+							p = ep; goto init;  /* return match(ms, s, ep); */
+						}
+						s = NULL;  /* match failed */
+						break;
+					}
+					case '0': case '1': case '2': case '3':
+					case '4': case '5': case '6': case '7':
+					case '8': case '9': {  /* capture results (%0-%9)? */
+						s = match_capture(ms, s, uchar(*(p + 1)));
+						if (s != NULL) {
+							p += 2; goto init;  /* return match(ms, s, p + 2) */
+						}
+						break;
+					}
+					default: goto dflt;
+				}
 				break;
 			}
-			case Kzstr: {  /* zero-terminated string */
-				size_t len;
-				const char *s = luamem_checkarray(L, arg, &len);
-				luaL_argcheck(L, memchr(s, '\0', len) == NULL, arg,
-				                 "string contains zeros");
-				if (!packstream(&mem, &i, lb, s, len) || !packchar(&mem, &i, lb, '\0'))
-					return packfailed(L, i, arg);
+			default: dflt: {  /* pattern class plus optional suffix */
+				const char *ep = classEnd(ms, p);  /* points to optional suffix */
+				/* does not match at least once? */
+				if (!singlematch(ms, s, p, ep)) {
+					if (*ep == '*' || *ep == '?' || *ep == '-') {  /* accept empty? */
+						p = ep + 1; goto init;  /* return match(ms, s, ep + 1); */
+					}
+					else  /* '+' or no suffix */
+						s = NULL;  /* fail */
+				}
+				else {  /* matched once */
+					switch (*ep) {  /* handle optional suffix */
+						case '?': {  /* optional */
+							const char *res;
+							if ((res = match(ms, s + 1, ep + 1)) != NULL)
+								s = res;
+							else {
+								p = ep + 1; goto init;  /* else return match(ms, s, ep + 1); */
+							}
+							break;
+						}
+						case '+':  /* 1 or more repetitions */
+							s++;  /* 1 match already done */
+							/* FALLTHROUGH */
+						case '*':  /* 0 or more repetitions */
+							s = max_expand(ms, s, p, ep);
+							break;
+						case '-':  /* 0 or more repetitions (minimum) */
+							s = min_expand(ms, s, p, ep);
+							break;
+						default:  /* no suffix */
+							s++; p = ep; goto init;  /* return match(ms, s + 1, ep); */
+					}
+				}
 				break;
 			}
-			case Kpadding: {
-				if (!getbytes(&mem, &i, lb, 1))
-					return packfailed(L, i, arg);
-			} /* FALLTHROUGH */
-			case Kpaddalign: case Knop:
-				arg--;  /* undo increment */
-				break;
 		}
 	}
-	lua_pushboolean(L, 1);
-	lua_pushinteger(L, i+1);
-	return 2;
+	ms->matchdepth++;
+	return s;
+}
+
+
+/*
+** get information about the i-th capture. If there are no captures
+** and 'i==0', return information about the whole match, which
+** is the range 's'..'e'. If the capture is a string, return
+** its length and put its address in '*cap'. If it is an integer
+** (a position), push it on the stack and return CAP_POSITION.
+*/
+static size_t get_onecapture (MatchState *ms, int i, const char *s,
+                              const char *e, const char **cap) {
+	if (i >= ms->level) {
+		if (l_unlikely(i != 0))
+			luaL_error(ms->L, "invalid capture index %%%d", i + 1);
+		*cap = s;
+		return e - s;
+	}
+	else {
+		ptrdiff_t capl = ms->capture[i].len;
+		*cap = ms->capture[i].init;
+		if (l_unlikely(capl == CAP_UNFINISHED))
+			luaL_error(ms->L, "unfinished capture");
+		else if (capl == CAP_POSITION)
+			lua_pushinteger(ms->L, (ms->capture[i].init - ms->src_init) + 1);
+		return capl;
+	}
+}
+
+
+/*
+** Push the i-th capture on the stack, as a string or as the positions of
+** its first and last bytes.
+*/
+static void push_onecapture (MatchState *ms, int i, const char *s,
+                                                    const char *e) {
+	const char *cap;
+	ptrdiff_t l = get_onecapture(ms, i, s, e, &cap);
+	if (l == CAP_POSITION) return;  /* position was already pushed */
+	if (ms->positions) {
+		lua_pushinteger(ms->L, (cap - ms->src_init) + 1);
+		lua_pushinteger(ms->L, (cap - ms->src_init) + l);
+	}
+	else lua_pushlstring(ms->L, cap, l);
+}
+
+
+static int push_captures (MatchState *ms, const char *s, const char *e) {
+	int i, n = lua_gettop(ms->L);
+	int nlevels = (ms->level == 0 && s) ? 1 : ms->level;
+	luaL_checkstack(ms->L, 2*nlevels, "too many captures");
+	for (i = 0; i < nlevels; i++)
+		push_onecapture(ms, i, s, e);
+	return lua_gettop(ms->L) - n;  /* number of values pushed */
+}
+
+
+/* check whether pattern has no special characters */
+static int nospecials (const char *p, size_t l) {
+	size_t upto = 0;
+	do {
+		if (strpbrk(p + upto, SPECIALS))
+			return 0;  /* pattern has a special character */
+		upto += strlen(p + upto) + 1;  /* may have more after \0 */
+	} while (upto <= l);
+	return 1;  /* no special chars found */
+}
+
+
+static void prepstate (MatchState *ms, lua_State *L, const char *s,
+                       size_t ls, const char *p, size_t lp, int positions) {
+	ms->L = L;
+	ms->matchdepth = MAXCCALLS;
+	ms->positions = positions;
+	ms->src_init = s;
+	ms->src_end = s + ls;
+	ms->p_end = p + lp;
+}
+
+
+static void reprepstate (MatchState *ms) {
+	ms->level = 0;
 }
 
 
 /*
-** Unpack an integer with 'size' bytes and 'islittle' endianness.
-** If size is smaller than the size of a Lua integer and integer
-** is signed, must do sign extension (propagating the sign to the
-** higher bits); if size is larger than the size of a Lua integer,
-** it must check the unread bytes to see whether they do not cause an
-** overflow.
+** Matches the pattern at argument 2 in the memory or string at argument
+** 1 from index 3 until index 4, pushing captures as strings only if
+** argument 5 is true.
 */
-static lua_Integer unpackint (lua_State *L, const char *str,
-                              int islittle, int size, int issigned) {
-	lua_Unsigned res = 0;
-	int i;
-	int limit = (size  <= SZINT) ? size : SZINT;
-	for (i = limit - 1; i >= 0; i--) {
-		res <<= NB;
-		res |= (lua_Unsigned)uchar(str[islittle ? i : size - 1 - i]);
+static int str_find_aux (lua_State *L, int find) {
+	size_t ls, lp;
+	const char *s = luamem_checkarray(L, 1, &ls);
+	const char *p = luaL_checklstring(L, 2, &lp);
+	size_t init = posrelatI(luaL_optinteger(L, 3, 1), ls) - 1;
+	size_t e = getendpos(L, 4, -1, ls);
+	int positions = !lua_toboolean(L, 5);
+	if (init > e) {  /* start after range's end? */
+		luaL_pushfail(L);  /* cannot find anything */
+		return 1;
 	}
-	if (size < SZINT) {  /* real size smaller than lua_Integer? */
-		if (issigned) {  /* needs sign extension? */
-			lua_Unsigned mask = (lua_Unsigned)1 << (size*NB - 1);
-			res = ((res ^ mask) - mask);  /* do sign extension */
+	/* explicit request or no special characters? */
+	if (find && nospecials(p, lp)) {
+		/* do a plain search */
+		const char *s2 = lmemfind(s + init, e - init, p, lp);
+		if (s2) {
+			lua_pushinteger(L, (s2 - s) + 1);
+			lua_pushinteger(L, (s2 - s) + lp);
+			return 2;
 		}
 	}
-	else if (size > SZINT) {  /* must check unread bytes */
-		int mask = (!issigned || (lua_Integer)res >= 0) ? 0 : MC;
-		for (i = limit; i < size; i++) {
-			if (uchar(str[islittle ? i : size - 1 - i]) != mask)
-				luaL_error(L, "%d-byte integer does not fit into Lua Integer", size);
+	else {
+		MatchState ms;
+		const char *s1 = s + init;
+		int anchor = (*p == '^');
+		if (anchor) {
+			p++; lp--;  /* skip anchor character */
 		}
+		prepstate(&ms, L, s, e, p, lp, positions);
+		do {
+			const char *res;
+			reprepstate(&ms);
+			if ((res=match(&ms, s1, p)) != NULL) {
+				if (find) {
+					lua_pushinteger(L, (s1 - s) + 1);  /* start */
+					lua_pushinteger(L, res - s);   /* end */
+					return push_captures(&ms, NULL, 0) + 2;
+				}
+				else
+					return push_captures(&ms, s1, res);
+			}
+		} while (s1++ < ms.src_end && !anchor);
 	}
-	return (lua_Integer)res;
+	luaL_pushfail(L);  /* not found */
+	return 1;
 }
 
 
-static int mem_unpack (lua_State *L) {
-	Header h;
-	size_t ld;
-	const char *data = luamem_checkmemory(L, 1, &ld);
-	const char *fmt = luaL_checkstring(L, 2);
-	size_t pos = posrelatI(luaL_optinteger(L, 3, 1), ld) - 1;
-	int n = 0;  /* number of results */
-	luaL_argcheck(L, pos <= ld, 3, "index out of bounds");
-	initheader(L, &h);
-	while (*fmt != '\0') {
-		int size, ntoalign;
-		KOption opt = getdetails(&h, pos, &fmt, &size, &ntoalign);
-		luaL_argcheck(L, (size_t)ntoalign + size <= ld - pos, 2,
-		                "data string too short");
-		pos += ntoalign;  /* skip alignment */
-		/* stack space for item + next position */
-		luaL_checkstack(L, 1, "too many results");
-		n++;
-		switch (opt) {
-			case Kint:
-			case Kuint: {
-				lua_Integer res = unpackint(L, data + pos, h.islittle, size,
-				                               (opt == Kint));
-				lua_pushinteger(L, res);
-				break;
-			}
-			case Kfloat: {
-				volatile Ftypes u;
-				lua_Number num;
-				copywithendian(u.buff, data + pos, size, h.islittle);
-				if (size == sizeof(u.f)) num = (lua_Number)u.f;
-				else if (size == sizeof(u.d)) num = (lua_Number)u.d;
-				else num = u.n;
-				lua_pushnumber(L, num);
-				break;
-			}
-			case Kchar: {
-				lua_pushlstring(L, data + pos, size);
-				break;
-			}
-			case Kstring: {
-				size_t len = (size_t)unpackint(L, data + pos, h.islittle, size, 0);
-				luaL_argcheck(L, len <= ld - pos - size, 2, "data string too short");
-				lua_pushlstring(L, data + pos + size, len);
-				pos += len;  /* skip string */
-				break;
-			}
-			case Kzstr: {
-				size_t len;
-				const char *z = (const char *)memchr(data + pos, '\0', ld - pos);
-				luaL_argcheck(L, z, 2, "unfinished string for format 'z'");
-				len = (size_t)(z - data - pos);
-				lua_pushlstring(L, data + pos, len);
-				pos += len + 1;  /* skip string plus final '\0' */
-				break;
-			}
-			case Kpaddalign: case Kpadding: case Knop:
-				n--;  /* undo increment */
-				break;
+/*
+** The state of the iteration is kept in upvalues with the memory, the
+** pattern, the position to continue, the end of the range, the end of
+** last match (or -1) and whether captures are strings, so the memory
+** can be resized between calls.
+*/
+static int gmatch_aux (lua_State *L) {
+	MatchState ms;
+	size_t ls, lp;
+	const char *s = luamem_toarray(L, lua_upvalueindex(1), &ls);
+	const char *p = lua_tolstring(L, lua_upvalueindex(2), &lp);
+	size_t i = (size_t)lua_tointeger(L, lua_upvalueindex(3));
+	size_t e = (size_t)lua_tointeger(L, lua_upvalueindex(4));
+	lua_Integer lastmatch = lua_tointeger(L, lua_upvalueindex(5));
+	const char *src;
+	if (e > ls) e = ls;  /* memory was resized */
+	if (s == NULL || i > e) return 0;  /* no more matches */
+	prepstate(&ms, L, s, e, p, lp, !lua_toboolean(L, lua_upvalueindex(6)));
+	for (src = s + i; src <= ms.src_end; src++) {
+		const char *end;
+		reprepstate(&ms);
+		if ((end = match(&ms, src, p)) != NULL &&
+		    (lastmatch < 0 || end != s + lastmatch)) {
+			lua_pushinteger(L, end - s);
+			lua_pushvalue(L, -1);
+			lua_replace(L, lua_upvalueindex(3));  /* continue after match */
+			lua_replace(L, lua_upvalueindex(5));  /* and avoid an empty match there */
+			return push_captures(&ms, src, end);
 		}
-		pos += size;
 	}
-	lua_pushinteger(L, pos + 1);  /* next position */
-	return n + 1;
+	lua_pushinteger(L, (lua_Integer)e+1);  /* not found */
+	lua_replace(L, lua_upvalueindex(3));
+	return 0;
+}
+
+
+static int gmatch (lua_State *L) {
+	size_t ls;
+	luamem_checkarray(L, 1, &ls);
+	luaL_checkstring(L, 2);
+	lua_settop(L, 5);
+	lua_pushvalue(L, 1);
+	lua_pushvalue(L, 2);
+	lua_pushinteger(L, (lua_Integer)posrelatI(luaL_optinteger(L, 3, 1), ls)-1);
+	lua_pushinteger(L, (lua_Integer)getendpos(L, 4, -1, ls));
+	lua_pushinteger(L, -1);  /* no last match */
+	lua_pushboolean(L, lua_toboolean(L, 5));
+	lua_pushcclosure(L, gmatch_aux, 6);
+	return 1;
 }
 
 /* }====================================================== */
@@ -2,14 +2,56 @@
 #define LUA_LIB
 #define LUAMEMLIB_API
 
+#if defined(LUA_USE_LINUX) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  /* for 'memfd_create' */
+#endif
+
 #include "luamem.h"
 
+#include <stdlib.h>
 #include <string.h>
 
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+    !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(LUA_USE_POSIX)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+
+/*
+** Memory metatables are marked with their type under a light userdata
+** key, so the type of a memory is usually found by a single raw access
+** to its metatable. Each copy of this library has its own key, so it
+** marks the metatables it creates, and 'luamem_type' marks those created
+** by other copies the first time it finds them by their names.
+*/
+static const char typekey = 'T';
+
+#define TYPEKEY	((const void *)&typekey)
+
+/*
+** Pushes the metatable 'tname' of memories of type 'type', marking it
+** when created, and returns whether it was created.
+*/
+static int pushmemmt (lua_State *L, const char *tname, int type) {
+	int created = luaL_newmetatable(L, tname);
+	if (created) {
+		lua_pushinteger(L, type);
+		lua_rawsetp(L, -2, TYPEKEY);
+	}
+	return created;
+}
 
 LUAMEMLIB_API char *luamem_newalloc (lua_State *L, size_t l) {
 	char *mem = (char *)lua_newuserdatauv(L, l * sizeof(char), 0);
-	luaL_newmetatable(L, LUAMEM_ALLOC);
+	pushmemmt(L, LUAMEM_ALLOC, LUAMEM_TALLOC);
 	lua_setmetatable(L, -2);
 	return mem;
 }
@@ -17,18 +59,154 @@ LUAMEMLIB_API char *luamem_newalloc (lua_State *L, size_t l) {
 typedef struct luamem_Ref {
 	char *mem;
 	size_t len;
+	size_t cap;  /* size of block 'mem' (may be larger than 'len') */
 	luamem_Unref unref;
 } luamem_Ref;
 
-#define unrefmem(L,r)	if (r->unref) ref->unref(L, r->mem, r->len)
+#define unrefmem(L,r)	if (r->unref) ref->unref(L, r->mem, r->cap)
+
+/*
+** A view is a referenced memory for a range of bytes of another memory,
+** which is kept alive in its user value. Views of referenced memories
+** find the bytes through the viewed memory on every access, so they
+** follow it when it is reallocated, and are empty while the range is
+** beyond its size.
+*/
+typedef struct View {
+	luamem_Ref ref;
+	luamem_Ref *viewed;  /* referenced memory viewed (NULL if fixed) */
+	size_t offset;  /* position of the view in 'viewed' */
+} View;
+
+static void viewunref (lua_State *L, void *mem, size_t len) {
+	(void)L; (void)mem; (void)len;  /* viewed memory is released by itself */
+}
+
+#define isview(r)	((r)->unref == viewunref)
+
+static char *viewmem (View *view, size_t *len) {
+	luamem_Ref *viewed = view->viewed;
+	if (viewed == NULL) {
+		*len = view->ref.len;
+		return view->ref.mem;
+	}
+	if (viewed->len < view->offset ||
+	    viewed->len - view->offset < view->ref.len) {  /* range is gone? */
+		*len = 0;
+		return NULL;
+	}
+	*len = view->ref.len;
+	return viewed->mem + view->offset;
+}
+
+/*
+** A ring is a referenced memory for the readable bytes of a circular
+** buffer, which are always contiguous: either the buffer is mapped twice
+** in a row (mirrored), so bytes that wrap around the end of the buffer
+** are also found past it, or the readable bytes are moved to the start
+** of the buffer when there is not enough space after them.
+*/
+typedef struct Ring {
+	luamem_Ref ref;  /* readable bytes */
+	char *buffer;
+	size_t size;  /* size of 'buffer' */
+	int mirrored;
+} Ring;
+
+static void ringunref (lua_State *L, void *mem, size_t len) {
+	(void)L; (void)mem; (void)len;  /* buffer is released by 'freering' */
+}
+
+#define isring(r)	((r)->unref == ringunref)
+
+static Ring *toring (lua_State *L, int idx) {
+	luamem_Ref *ref;
+	if (luamem_type(L, idx) != LUAMEM_TREF) return NULL;
+	ref = (luamem_Ref *)lua_touserdata(L, idx);
+	return isring(ref) ? (Ring *)ref : NULL;
+}
+
+#if defined(LUA_USE_POSIX)
+
+static int ringfd (size_t size) {
+	int fd = -1;
+#if defined(MFD_CLOEXEC)
+	fd = memfd_create("luamem_ring", MFD_CLOEXEC);
+#elif !defined(LUA_USE_LINUX)
+	char name[64];
+	snprintf(name, sizeof(name), "/luamem_ring.%ld.%p",
+	         (long)getpid(), (void *)&fd);
+	fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+	if (fd != -1) shm_unlink(name);
+#endif
+	if (fd != -1 && ftruncate(fd, (off_t)size) == -1) {
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+static char *mirrormap (size_t size) {
+	char *mem = NULL;
+	int fd = ringfd(size);
+	if (fd != -1) {
+		char *p = (char *)mmap(NULL, 2*size, PROT_NONE,
+		                       MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (p != (char *)MAP_FAILED) {
+			if (mmap(p, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED,
+			         fd, 0) != MAP_FAILED &&
+			    mmap(p+size, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED,
+			         fd, 0) != MAP_FAILED)
+				mem = p;
+			else
+				munmap(p, 2*size);
+		}
+		close(fd);
+	}
+	return mem;
+}
+
+static size_t mirrorsize (size_t size) {
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	if (size > LUAMEM_MAXSIZE - page) return 0;  /* too large? */
+	return (size + page - 1) / page * page;
+}
+
+#else
+
+#define mirrormap(S)	NULL
+#define mirrorsize(S)	0
+
+#endif
+
+static void freering (lua_State *L, Ring *ring) {
+#if defined(LUA_USE_POSIX)
+	if (ring->mirrored) munmap(ring->buffer, 2*ring->size);
+	else
+#endif
+	luamem_free(L, ring->buffer, ring->size);
+	ring->buffer = NULL;
+	ring->size = 0;
+}
+
+static void releaseref (lua_State *L, luamem_Ref *ref) {
+	if (isring(ref)) freering(L, (Ring *)ref);
+	else unrefmem(L, ref);
+}
 
 static int refgc (lua_State *L) {
 	luamem_Ref *ref = (luamem_Ref *)lua_touserdata(L, 1);
-	if (ref && ref->len) {
-		unrefmem(L, ref);
+	if (ref && (ref->cap || isview(ref))) {
+		int view = isview(ref);
+		releaseref(L, ref);
 		ref->mem = NULL;
 		ref->len = 0;
+		ref->cap = 0;
 		ref->unref = NULL;
+		if (view) {
+			lua_pushnil(L);
+			lua_setiuservalue(L, 1, 1);  /* release viewed memory */
+		}
 	}
 	return 0;
 }
@@ -39,44 +217,230 @@ static const luaL_Reg refmt[] = {  /* metamethods */
 	{NULL, NULL}
 };
 
+static void pushrefmt (lua_State *L) {
+	if (pushmemmt(L, LUAMEM_REF, LUAMEM_TREF)) luaL_setfuncs(L, refmt, 0);
+}
+
 LUAMEMLIB_API void luamem_newref (lua_State *L) {
 	luamem_Ref *ref = (luamem_Ref *)lua_newuserdatauv(L, sizeof(luamem_Ref), 0);
 	ref->mem = NULL;
 	ref->len = 0;
+	ref->cap = 0;
 	ref->unref = NULL;
-	if (luaL_newmetatable(L, LUAMEM_REF)) luaL_setfuncs(L, refmt, 0);
+	pushrefmt(L);
+	lua_setmetatable(L, -2);
+}
+
+LUAMEMLIB_API char *luamem_newview (lua_State *L, int idx,
+                                    size_t offset, size_t len) {
+	int type;
+	luamem_Ref *viewed = NULL;
+	char *mem = luamem_tomemoryx(L, idx, NULL, NULL, &type);
+	View *view;
+	idx = lua_absindex(L, idx);
+	lua_pushvalue(L, idx);  /* memory to be kept alive */
+	if (type == LUAMEM_TREF) {
+		viewed = (luamem_Ref *)lua_touserdata(L, idx);
+		if (isview(viewed)) {  /* view of a view? */
+			View *inner = (View *)viewed;
+			lua_getiuservalue(L, idx, 1);  /* view its viewed memory instead */
+			lua_replace(L, -2);
+			viewed = inner->viewed;
+			if (viewed) offset += inner->offset;
+		}
+	}
+	view = (View *)lua_newuserdatauv(L, sizeof(View), 1);
+	view->ref.mem = viewed ? NULL : mem+offset;
+	view->ref.len = len;
+	view->ref.cap = len;
+	view->ref.unref = viewunref;
+	view->viewed = viewed;
+	view->offset = offset;
+	pushrefmt(L);
 	lua_setmetatable(L, -2);
+	lua_insert(L, -2);
+	lua_setiuservalue(L, -2, 1);  /* keep viewed memory alive */
+	return viewed ? viewed->mem+offset : mem+offset;
+}
+
+LUAMEMLIB_API void luamem_newring (lua_State *L, size_t size, int mirror) {
+	Ring *ring = (Ring *)lua_newuserdatauv(L, sizeof(Ring), 0);
+	size_t mirrored = mirror ? mirrorsize(size) : 0;
+	ring->ref.mem = NULL;
+	ring->ref.len = 0;
+	ring->ref.cap = 0;
+	ring->ref.unref = ringunref;
+	ring->buffer = NULL;
+	ring->size = 0;
+	ring->mirrored = 0;
+	pushrefmt(L);
+	lua_setmetatable(L, -2);
+	if (mirrored > 0 && (ring->buffer = mirrormap(mirrored)) != NULL) {
+		size = mirrored;
+		ring->mirrored = 1;
+	}
+	else {
+		ring->buffer = (char *)luamem_realloc(L, NULL, 0, size);
+		if (l_unlikely(ring->buffer == NULL && size > 0))
+			luaL_error(L, "not enough memory");
+	}
+	ring->size = size;
+	ring->ref.mem = ring->buffer;
+	ring->ref.cap = size;
+}
+
+/*
+** Returns the space after the readable bytes of the ring at 'idx'. When
+** it is smaller than 'need' bytes, the readable bytes are moved to the
+** start of a buffer that is not mirrored, so all free bytes follow them.
+*/
+LUAMEMLIB_API char *luamem_ringspace (lua_State *L, int idx, size_t need,
+                                      size_t *len) {
+	Ring *ring = toring(L, idx);
+	luamem_Ref *ref;
+	size_t tail;
+	if (ring == NULL) return NULL;
+	ref = &ring->ref;
+	if (ring->mirrored) tail = ring->size - ref->len;
+	else {
+		tail = ring->size - (size_t)(ref->mem - ring->buffer) - ref->len;
+		if (tail < need && ref->mem != ring->buffer) {
+			memmove(ring->buffer, ref->mem, ref->len);
+			ref->mem = ring->buffer;
+			tail = ring->size - ref->len;
+		}
+	}
+	if (len) *len = tail;
+	return ref->mem + ref->len;
+}
+
+LUAMEMLIB_API size_t luamem_produce (lua_State *L, int idx, size_t n) {
+	size_t tail;
+	Ring *ring = toring(L, idx);
+	if (ring == NULL) return 0;
+	luamem_ringspace(L, idx, 0, &tail);
+	if (n > tail) n = tail;
+	ring->ref.len += n;
+	return n;
+}
+
+LUAMEMLIB_API size_t luamem_consume (lua_State *L, int idx, size_t n) {
+	Ring *ring = toring(L, idx);
+	luamem_Ref *ref;
+	if (ring == NULL) return 0;
+	ref = &ring->ref;
+	if (n >= ref->len) {
+		n = ref->len;
+		ref->mem = ring->buffer;  /* empty rings restart from the beginning */
+		ref->len = 0;
+	}
+	else {
+		ref->mem += n;
+		ref->len -= n;
+		if (ref->mem >= ring->buffer + ring->size)  /* in the mirror? */
+			ref->mem -= ring->size;
+	}
+	return n;
 }
 
 LUAMEMLIB_API int luamem_resetref (lua_State *L, int idx, 
                                    char *mem, size_t len, luamem_Unref unref,
                                    int cleanup) {
-	luamem_Ref *ref = (luamem_Ref *)luaL_testudata(L, idx, LUAMEM_REF);
-	if (ref) {
-		if (mem != ref->mem) {
-			if (cleanup) unrefmem(L, ref);
+	if (luamem_type(L, idx) == LUAMEM_TREF) {
+		luamem_Ref *ref = (luamem_Ref *)lua_touserdata(L, idx);
+		if (mem != ref->mem || isring(ref)) {
+			if (cleanup) releaseref(L, ref);
 			ref->mem = mem;
 		}
 		ref->len = len;
+		ref->cap = len;
 		ref->unref = unref;
 		return 1;
 	}
 	return 0;
 }
 
+LUAMEMLIB_API size_t luamem_capacity (lua_State *L, int idx) {
+	int type;
+	size_t len;
+	luamem_tomemoryx(L, idx, &len, NULL, &type);
+	if (type == LUAMEM_TREF) {
+		luamem_Ref *ref = (luamem_Ref *)lua_touserdata(L, idx);
+		if (!isview(ref)) return ref->cap;
+	}
+	return len;
+}
+
+static luamem_Ref *toresizable (lua_State *L, int idx) {
+	luamem_Ref *ref;
+	if (luamem_type(L, idx) != LUAMEM_TREF) return NULL;
+	ref = (luamem_Ref *)lua_touserdata(L, idx);
+	return ref->unref == luamem_free ? ref : NULL;
+}
+
+static void reallocref (lua_State *L, luamem_Ref *ref, size_t cap) {
+	char *mem = (char *)luamem_realloc(L, ref->mem, ref->cap, cap);
+	if (l_unlikely(mem == NULL && cap > 0))  /* allocation error? */
+		luaL_error(L, "not enough memory");
+	ref->mem = mem;
+	ref->cap = cap;
+	if (ref->len > cap) ref->len = cap;
+}
+
+LUAMEMLIB_API char *luamem_reallocref (lua_State *L, int idx, size_t cap) {
+	luamem_Ref *ref = toresizable(L, idx);
+	if (ref == NULL) return NULL;
+	if (cap < ref->len) cap = ref->len;
+	if (cap != ref->cap) reallocref(L, ref, cap);
+	return ref->mem;
+}
+
+/*
+** Changes the length of resizable memory at 'idx' to 'len', doubling
+** its capacity when it is not enough, so a sequence of small
+** increments of its length costs amortized constant time.
+*/
+LUAMEMLIB_API char *luamem_growref (lua_State *L, int idx, size_t len) {
+	luamem_Ref *ref = toresizable(L, idx);
+	if (ref == NULL) return NULL;
+	if (len > ref->cap) {
+		size_t cap = ref->cap * 2;  /* double capacity */
+		if (ref->cap > LUAMEM_MAXSIZE / 2)  /* would exceed maximum size? */
+			cap = LUAMEM_MAXSIZE;
+		if (cap < len)  /* double is not big enough? */
+			cap = len;
+		reallocref(L, ref, cap);
+	}
+	ref->len = len;
+	return ref->mem;
+}
+
+/* returns the type of memories with metatable at the top, and marks it */
+static int marktype (lua_State *L) {
+	int type = LUAMEM_TNONE;
+	luaL_getmetatable(L, LUAMEM_ALLOC);  /* get allocated memory metatable */
+	if (lua_rawequal(L, -1, -2)) type = LUAMEM_TALLOC;
+	else {
+		lua_pop(L, 1);  /* remove allocated memory metatable */
+		luaL_getmetatable(L, LUAMEM_REF);  /* get referenced memory metatable */
+		if (lua_rawequal(L, -1, -2)) type = LUAMEM_TREF;
+	}
+	lua_pop(L, 1);  /* remove memory metatable */
+	if (type != LUAMEM_TNONE) {  /* created by another copy of the library? */
+		lua_pushinteger(L, type);
+		lua_rawsetp(L, -2, TYPEKEY);
+	}
+	return type;
+}
+
 LUAMEMLIB_API int luamem_type (lua_State *L, int idx) {
 	int type = LUAMEM_TNONE;
-	if (lua_type(L, idx) == LUA_TUSERDATA) {
-		if (lua_getmetatable(L, idx)) {  /* does it have a metatable? */
-			luaL_getmetatable(L, LUAMEM_ALLOC);  /* get allocated memory metatable */
-			if (lua_rawequal(L, -1, -2)) type = LUAMEM_TALLOC;
-			else {
-				lua_pop(L, 1);  /* remove allocated memory metatable */
-				luaL_getmetatable(L, LUAMEM_REF);  /* get referenced memory metatable */
-				if (lua_rawequal(L, -1, -2)) type = LUAMEM_TREF;
-			}
-			lua_pop(L, 2);  /* remove both metatables */
-		}
+	if (lua_type(L, idx) == LUA_TUSERDATA && lua_getmetatable(L, idx)) {
+		if (lua_rawgetp(L, -1, TYPEKEY) == LUA_TNUMBER)  /* marked? */
+			type = (int)lua_tointeger(L, -1);
+		lua_pop(L, 1);  /* remove mark */
+		if (type == LUAMEM_TNONE) type = marktype(L);
+		lua_pop(L, 1);  /* remove metatable */
 	}
 	return type;
 }
@@ -94,8 +458,14 @@ LUAMEMLIB_API char *luamem_tomemoryx (lua_State *L, int idx,
 			return (char *)lua_touserdata(L, idx);
 		case LUAMEM_TREF: {
 			luamem_Ref *ref = (luamem_Ref *)lua_touserdata(L, idx);
-			if (len) *len = ref->len;
 			if (unref) *unref = ref->unref;
+			if (isview(ref)) {
+				size_t l;
+				char *mem = viewmem((View *)ref, &l);
+				if (len) *len = l;
+				return mem;
+			}
+			if (len) *len = ref->len;
 			return ref->mem;
 		}
 	}
@@ -154,6 +524,140 @@ LUAMEMLIB_API const char *luamem_optarray (lua_State *L,
 	else return luamem_checkarray(L, arg, len);
 }
 
+#if defined(LUA_USE_POSIX)
+LUAMEMLIB_API int luamem_toiovec (lua_State *L, int idx, int n,
+                                  struct iovec *iov) {
+	int i;
+	idx = lua_absindex(L, idx);
+	for (i = 0; i < n; i++) {
+		size_t len;
+		int type;
+		char *s = luamem_tomemoryx(L, idx+i, &len, NULL, &type);
+		if (type == LUAMEM_TNONE) {
+			s = (char *)lua_tolstring(L, idx+i, &len);
+			if (s == NULL) break;  /* not a string nor memory */
+		}
+		iov[i].iov_base = s;
+		iov[i].iov_len = len;
+	}
+	return i;
+}
+#endif
+
+
+
+/*
+** {======================================================
+** Shared memory
+** =======================================================
+*/
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+    !defined(__STDC_NO_ATOMICS__)
+#define SHAREDSUPPORT
+typedef atomic_long SharedCount;
+#define incshared(c)	((void)atomic_fetch_add_explicit(c, 1, memory_order_relaxed))
+#define decshared(c)	(atomic_fetch_sub_explicit(c, 1, memory_order_acq_rel)-1)
+#elif defined(__GNUC__)
+#define SHAREDSUPPORT
+typedef long SharedCount;
+#define incshared(c)	__atomic_add_fetch(c, 1, __ATOMIC_RELAXED)
+#define decshared(c)	__atomic_sub_fetch(c, 1, __ATOMIC_ACQ_REL)
+#elif defined(_MSC_VER)
+#define SHAREDSUPPORT
+typedef long volatile SharedCount;
+#define incshared(c)	_InterlockedIncrement(c)
+#define decshared(c)	_InterlockedDecrement(c)
+#endif
+
+#if defined(SHAREDSUPPORT)
+
+/*
+** Memory shared by the Lua states of a process is allocated by the C
+** library after a header with its number of references, which are held
+** by memories and by tokens, so it is freed only when the last of them
+** is released. Tokens are the addresses of these headers.
+*/
+typedef union SharedHeader {
+	struct {
+		SharedCount refs;
+		size_t len;
+	} info;
+	LUAI_MAXALIGN;  /* ensures maximum alignment for the contents */
+} SharedHeader;
+
+#define sharedheader(m)	((SharedHeader *)(m) - 1)
+
+static void unrefshared (SharedHeader *h) {
+	if (decshared(&h->info.refs) == 0) free(h);
+}
+
+static void sharedunref (lua_State *L, void *mem, size_t len) {
+	(void)L; (void)len;
+	unrefshared(sharedheader(mem));
+}
+
+static SharedHeader *newshared (lua_State *L, const char *s, size_t len) {
+	SharedHeader *h;
+	if (len > MAX_SIZET - sizeof(SharedHeader))
+		luaL_error(L, "memory size too large");
+	h = (SharedHeader *)malloc(sizeof(SharedHeader) + len);
+	if (h == NULL) luaL_error(L, "not enough memory");
+	h->info.refs = 1;  /* reference held by the token */
+	h->info.len = len;
+	if (s) memcpy(h+1, s, len*sizeof(char));
+	else memset(h+1, 0, len*sizeof(char));
+	return h;
+}
+
+LUAMEMLIB_API void *luamem_share (lua_State *L, int idx) {
+	size_t len;
+	const char *s = NULL;
+	luamem_Unref unref;
+	if (lua_type(L, idx) == LUA_TNUMBER) len = luamem_checklenarg(L, idx);
+	else s = luamem_checkarray(L, idx, &len);
+	luamem_tomemoryx(L, idx, NULL, &unref, NULL);
+	if (unref == sharedunref) {  /* already shared memory? */
+		SharedHeader *h = sharedheader(s);
+		incshared(&h->info.refs);  /* reference held by the token */
+		return h;
+	}
+	return newshared(L, s, len);
+}
+
+LUAMEMLIB_API void luamem_attach (lua_State *L, void *token) {
+	SharedHeader *h = (SharedHeader *)token;
+	luamem_newref(L);
+	if (h->info.len > 0)  /* takes over the reference of the token */
+		luamem_setref(L, -1, (char *)(h+1), h->info.len, sharedunref);
+	else unrefshared(h);  /* empty memories hold no reference */
+}
+
+LUAMEMLIB_API void luamem_unshare (void *token) {
+	unrefshared((SharedHeader *)token);
+}
+
+#else
+
+LUAMEMLIB_API void *luamem_share (lua_State *L, int idx) {
+	(void)idx;
+	luaL_error(L, "shared memory not supported");
+	return NULL;
+}
+
+LUAMEMLIB_API void luamem_attach (lua_State *L, void *token) {
+	(void)token;
+	luaL_error(L, "shared memory not supported");
+}
+
+LUAMEMLIB_API void luamem_unshare (void *token) {
+	(void)token;
+}
+
+#endif
+
+/* }====================================================== */
+
 
 LUAMEMLIB_API void *luamem_realloc(lua_State *L, void *mem, size_t osize,
                                                             size_t nsize) {
@@ -268,15 +772,15 @@ static void newbox (lua_State *L) {
 
 
 /*
-** Compute new size for buffer 'B', enough to accommodate extra 'sz'
-** bytes.
+** Compute new size for a buffer of 'size' bytes with 'n' bytes used,
+** enough to accommodate extra 'sz' bytes.
 */
-static size_t newbuffsize (luaL_Buffer *B, size_t sz) {
-	size_t newsize = B->size * 2;  /* double buffer size */
-	if (l_unlikely(MAX_SIZET - sz < B->n))  /* overflow in (B->n + sz)? */
-		return luaL_error(B->L, "buffer too large");
-	if (newsize < B->n + sz)  /* double is not big enough? */
-		newsize = B->n + sz;
+static size_t newbuffsize (lua_State *L, size_t size, size_t n, size_t sz) {
+	size_t newsize = size * 2;  /* double buffer size */
+	if (l_unlikely(MAX_SIZET - sz < n))  /* overflow in (n + sz)? */
+		return luaL_error(L, "buffer too large");
+	if (newsize < n + sz)  /* double is not big enough? */
+		newsize = n + sz;
 	return newsize;
 }
 
@@ -293,7 +797,7 @@ static char *prepbuffsize (luaL_Buffer *B, size_t sz, int boxidx) {
 	else {
 		lua_State *L = B->L;
 		char *newbuff;
-		size_t newsize = newbuffsize(B, sz);
+		size_t newsize = newbuffsize(L, B->size, B->n, sz);
 		/* create larger buffer */
 		if (buffonstack(B))  /* buffer already has a box? */
 			newbuff = (char *)resizebox(L, boxidx, newsize);  /* resize it */
@@ -322,4 +826,695 @@ LUAMEMLIB_API void luamem_addvalue (luaL_Buffer *B) {
 	lua_pop(L, 1);  /* pop string */
 }
 
+
+/*
+** Buffers of module 'memory' keep their contents in a resizable memory
+** on the top of the stack, which is the result of the buffer.
+*/
+
+LUAMEMLIB_API void luamem_buffinit (lua_State *L, luamem_Buffer *B) {
+	B->L = L;
+	B->b = NULL;
+	B->size = 0;
+	B->n = 0;
+	luamem_newref(L);
+	luamem_resetref(L, -1, NULL, 0, luamem_free, 0);
+}
+
+LUAMEMLIB_API char *luamem_prepbuffsize (luamem_Buffer *B, size_t sz) {
+	if (B->size - B->n < sz) {  /* not enough space? */
+		size_t newsize = newbuffsize(B->L, B->size, B->n, sz);
+		B->b = luamem_reallocref(B->L, -1, newsize);
+		B->size = newsize;
+	}
+	return B->b + B->n;
+}
+
+LUAMEMLIB_API void luamem_addlstring (luamem_Buffer *B, const char *s,
+                                      size_t l) {
+	if (l > 0) {  /* avoid 'memcpy' when 's' can be NULL */
+		char *b = luamem_prepbuffsize(B, l);
+		memcpy(b, s, l * sizeof(char));
+		luamem_addsize(B, l);
+	}
+}
+
+LUAMEMLIB_API void luamem_pushresult (luamem_Buffer *B) {
+	luamem_growref(B->L, -1, B->n);  /* contents become the memory */
+}
+
+LUAMEMLIB_API void luamem_pushresultsize (luamem_Buffer *B, size_t sz) {
+	luamem_addsize(B, sz);
+	luamem_pushresult(B);
+}
+
+LUAMEMLIB_API char *luamem_buffinitsize (lua_State *L, luamem_Buffer *B,
+                                         size_t sz) {
+	luamem_buffinit(L, B);
+	return luamem_prepbuffsize(B, sz);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** PACK/UNPACK
+** =======================================================
+*/
+
+/* value used for padding */
+#if !defined(LUAL_PACKPADBYTE)
+#define LUAL_PACKPADBYTE		0x00
+#endif
+
+/* maximum size for the binary representation of an integer */
+#define MAXINTSIZE	16
+
+/* number of bits in a character */
+#define NB	CHAR_BIT
+
+/* mask for one character (NB 1's) */
+#define MC	((1 << NB) - 1)
+
+/* size of a lua_Integer */
+#define SZINT	((int)sizeof(lua_Integer))
+
+/* macro to 'unsign' a character */
+#define uchar(c)	((unsigned char)(c))
+
+
+/* dummy union to get native endianness */
+static const union {
+	int dummy;
+	char little;  /* true iff machine is little endian */
+} nativeendian = {1};
+
+
+/* dummy structure to get native alignment requirements */
+struct cD {
+	char c;
+	union { double d; void *p; lua_Integer i; lua_Number n; } u;
+};
+
+#define MAXALIGN	(offsetof(struct cD, u))
+
+
+/*
+** Union for serializing floats
+*/
+typedef union Ftypes {
+	float f;
+	double d;
+	lua_Number n;
+	char buff[5 * sizeof(lua_Number)];  /* enough for any float type */
+} Ftypes;
+
+
+/*
+** information to pack/unpack stuff
+*/
+typedef struct Header {
+	lua_State *L;
+	int islittle;
+	int maxalign;
+} Header;
+
+
+/*
+** options for pack/unpack
+*/
+typedef enum KOption {
+	Kint,		/* signed integers */
+	Kuint,	/* unsigned integers */
+	Kfloat,	/* floating-point numbers */
+	Kchar,	/* fixed-length strings */
+	Kstring,	/* strings with prefixed length */
+	Kzstr,	/* zero-terminated strings */
+	Kpadding,	/* padding */
+	Kpaddalign,	/* padding for alignment */
+	Knop		/* no-op (configuration or spaces) */
+} KOption;
+
+
+/*
+** Read an integer numeral from string 'fmt' or return 'df' if
+** there is no numeral
+*/
+static int digit (int c) { return '0' <= c && c <= '9'; }
+
+static int getnum (const char **fmt, int df) {
+	if (!digit(**fmt))  /* no number? */
+		return df;  /* return default value */
+	else {
+		int a = 0;
+		do {
+			a = a*10 + (*((*fmt)++) - '0');
+		} while (digit(**fmt) && a <= ((int)LUAMEM_MAXSIZE - 9)/10);
+		return a;
+	}
+}
+
+
+/*
+** Read an integer numeral and raises an error if it is larger
+** than the maximum size for integers.
+*/
+static int getnumlimit (Header *h, const char **fmt, int df) {
+	int sz = getnum(fmt, df);
+	if (sz > MAXINTSIZE || sz <= 0)
+		return luaL_error(h->L, "integral size (%d) out of limits [1,%d]",
+		                        sz, MAXINTSIZE);
+	return sz;
+}
+
+
+/*
+** Initialize Header
+*/
+static void initheader (lua_State *L, Header *h) {
+	h->L = L;
+	h->islittle = nativeendian.little;
+	h->maxalign = 1;
+}
+
+
+/*
+** Read and classify next option. 'size' is filled with option's size.
+*/
+static KOption getoption (Header *h, const char **fmt, int *size) {
+	int opt = *((*fmt)++);
+	*size = 0;  /* default */
+	switch (opt) {
+		case 'b': *size = sizeof(char); return Kint;
+		case 'B': *size = sizeof(char); return Kuint;
+		case 'h': *size = sizeof(short); return Kint;
+		case 'H': *size = sizeof(short); return Kuint;
+		case 'l': *size = sizeof(long); return Kint;
+		case 'L': *size = sizeof(long); return Kuint;
+		case 'j': *size = sizeof(lua_Integer); return Kint;
+		case 'J': *size = sizeof(lua_Integer); return Kuint;
+		case 'T': *size = sizeof(size_t); return Kuint;
+		case 'f': *size = sizeof(float); return Kfloat;
+		case 'd': *size = sizeof(double); return Kfloat;
+		case 'n': *size = sizeof(lua_Number); return Kfloat;
+		case 'i': *size = getnumlimit(h, fmt, sizeof(int)); return Kint;
+		case 'I': *size = getnumlimit(h, fmt, sizeof(int)); return Kuint;
+		case 's': *size = getnumlimit(h, fmt, sizeof(size_t)); return Kstring;
+		case 'c':
+			*size = getnum(fmt, -1);
+			if (*size == -1)
+				luaL_error(h->L, "missing size for format option 'c'");
+			return Kchar;
+		case 'z': return Kzstr;
+		case 'x': *size = 1; return Kpadding;
+		case 'X': return Kpaddalign;
+		case ' ': break;
+		case '<': h->islittle = 1; break;
+		case '>': h->islittle = 0; break;
+		case '=': h->islittle = nativeendian.little; break;
+		case '!': h->maxalign = getnumlimit(h, fmt, MAXALIGN); break;
+		default: luaL_error(h->L, "invalid format option '%c'", opt);
+	}
+	return Knop;
+}
+
+
+/*
+** Read, classify, and fill other details about the next option.
+** 'psize' is filled with option's size, 'palign' with its
+** alignment requirements (a power of 2, or 1 for no alignment).
+** Local variable 'size' gets the size to be aligned. (Kpadal option
+** always gets its full alignment, other options are limited by
+** the maximum alignment ('maxalign'). Kchar option needs no alignment
+** despite its size.
+*/
+static KOption getdetails (Header *h, const char **fmt, int *psize,
+                           int *palign) {
+	KOption opt = getoption(h, fmt, psize);
+	int align = *psize;  /* usually, alignment follows size */
+	if (opt == Kpaddalign) {  /* 'X' gets alignment from following option */
+		if (**fmt == '\0' || getoption(h, fmt, &align) == Kchar || align == 0)
+			luaL_argerror(h->L, 1, "invalid next option for option 'X'");
+	}
+	if (align <= 1 || opt == Kchar)  /* need no alignment? */
+		*palign = 1;
+	else {
+		if (align > h->maxalign)  /* enforce maximum alignment */
+			align = h->maxalign;
+		if ((align & (align - 1)) != 0)  /* is 'align' not a power of 2? */
+			luaL_argerror(h->L, 1, "format asks for alignment not power of 2");
+		*palign = align;
+	}
+	return opt;
+}
+
+
+/*
+** Number of bytes to skip from 'pos' to reach alignment 'align'.
+*/
+#define ntoalign(pos,align)	((size_t)(0-(pos)) & ((size_t)(align) - 1))
+
+
+/*
+** Pack integer 'n' with 'size' bytes and 'islittle' endianness.
+** The final 'if' handles the case when 'size' is larger than
+** the size of a Lua integer, correcting the extra sign-extension
+** bytes if necessary (by default they would be zeros).
+*/
+static void packint (char *buff, lua_Unsigned n,
+                     int islittle, int size, int neg) {
+	int i;
+	buff[islittle ? 0 : size - 1] = (char)(n & MC);  /* first byte */
+	for (i = 1; i < size; i++) {
+		n >>= NB;
+		buff[islittle ? i : size - 1 - i] = (char)(n & MC);
+	}
+	if (neg && size > SZINT) {  /* negative number need sign extension? */
+		for (i = SZINT; i < size; i++)  /* correct extra bytes */
+			buff[islittle ? i : size - 1 - i] = (char)MC;
+	}
+}
+
+
+/*
+** Copy 'size' bytes from 'src' to 'dest', correcting endianness if
+** given 'islittle' is different from native endianness.
+*/
+static void copywithendian (volatile char *dest, volatile const char *src,
+                            int size, int islittle) {
+	if (islittle == nativeendian.little) {
+		while (size-- != 0)
+			*(dest++) = *(src++);
+	}
+	else {
+		dest += size - 1;
+		while (size-- != 0)
+			*(dest--) = *(src++);
+	}
+}
+
+
+/*
+** Unpack an integer with 'size' bytes and 'islittle' endianness.
+** If size is smaller than the size of a Lua integer and integer
+** is signed, must do sign extension (propagating the sign to the
+** higher bits); if size is larger than the size of a Lua integer,
+** it must check the unread bytes to see whether they do not cause an
+** overflow.
+*/
+static lua_Integer unpackint (lua_State *L, const char *str,
+                              int islittle, int size, int issigned) {
+	lua_Unsigned res = 0;
+	int i;
+	int limit = (size  <= SZINT) ? size : SZINT;
+	for (i = limit - 1; i >= 0; i--) {
+		res <<= NB;
+		res |= (lua_Unsigned)uchar(str[islittle ? i : size - 1 - i]);
+	}
+	if (size < SZINT) {  /* real size smaller than lua_Integer? */
+		if (issigned) {  /* needs sign extension? */
+			lua_Unsigned mask = (lua_Unsigned)1 << (size*NB - 1);
+			res = ((res ^ mask) - mask);  /* do sign extension */
+		}
+	}
+	else if (size > SZINT) {  /* must check unread bytes */
+		int mask = (!issigned || (lua_Integer)res >= 0) ? 0 : MC;
+		for (i = limit; i < size; i++) {
+			if (uchar(str[islittle ? i : size - 1 - i]) != mask)
+				luaL_error(L, "%d-byte integer does not fit into Lua Integer", size);
+		}
+	}
+	return (lua_Integer)res;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Pre-compiled pack/unpack layouts
+** =======================================================
+*/
+
+/*
+** A layout is the result of parsing a format string once: an array
+** with one operation for each option that reads or writes bytes.
+** When the layout has no variable-length options ('s' and 'z'), the
+** offset of each operation from the start of the layout is also
+** computed, so a layout that starts at a position aligned to its
+** largest alignment can be checked against the available bytes
+** only once for all its values.
+*/
+
+typedef struct LayoutOp {
+	unsigned char opt;  /* 'KOption' of the operation */
+	unsigned char islittle;  /* endianness of the operation */
+	unsigned char align;  /* alignment required (power of 2) */
+	int size;  /* size of the option (without string contents) */
+	size_t offset;  /* offset from layout start (if it is fixed) */
+} LayoutOp;
+
+struct luamem_Layout {
+	size_t size;  /* total size of a fixed layout */
+	int fixed;  /* true if layout has no variable-length option */
+	int maxalign;  /* largest alignment required by any operation */
+	int nvalues;  /* number of values packed or unpacked */
+	int nops;  /* number of operations in 'op' */
+	LayoutOp op[1];
+};
+
+#define layoutsize(n)	(sizeof(luamem_Layout)+((n)>0?(n)-1:0)*sizeof(LayoutOp))
+
+#define takesvalue(o)	((o) < Kpadding)
+
+
+/*
+** Parse format 'fmt' filling 'layout' with its operations, or just
+** count them if 'layout' is NULL. Returns the number of operations.
+*/
+static int compilelayout (lua_State *L, const char *fmt,
+                          luamem_Layout *layout) {
+	Header h;
+	size_t pos = 0;
+	int nops = 0;
+	initheader(L, &h);
+	if (layout) {
+		layout->fixed = 1;
+		layout->maxalign = 1;
+		layout->nvalues = 0;
+	}
+	while (*fmt != '\0') {
+		int size, align;
+		KOption opt = getdetails(&h, &fmt, &size, &align);
+		if (opt == Knop) continue;
+		if (layout) {
+			LayoutOp *op = &layout->op[nops];
+			pos += ntoalign(pos, align);
+			op->opt = (unsigned char)opt;
+			op->islittle = (unsigned char)h.islittle;
+			op->align = (unsigned char)align;
+			op->size = size;
+			op->offset = pos;
+			pos += size;
+			if (align > layout->maxalign) layout->maxalign = align;
+			if (opt == Kstring || opt == Kzstr) layout->fixed = 0;
+			if (takesvalue(opt)) layout->nvalues++;
+		}
+		nops++;
+	}
+	if (layout) {
+		layout->nops = nops;
+		layout->size = layout->fixed ? pos : 0;
+	}
+	return nops;
+}
+
+LUAMEMLIB_API luamem_Layout *luamem_newlayout (lua_State *L,
+                                               const char *fmt) {
+	int nops = compilelayout(L, fmt, NULL);  /* check format and count */
+	luamem_Layout *layout =
+		(luamem_Layout *)lua_newuserdatauv(L, layoutsize(nops), 0);
+	compilelayout(L, fmt, layout);
+	luaL_newmetatable(L, LUAMEM_LAYOUT);
+	lua_setmetatable(L, -2);
+	return layout;
+}
+
+LUAMEMLIB_API luamem_Layout *luamem_tolayout (lua_State *L, int idx) {
+	return (luamem_Layout *)luaL_testudata(L, idx, LUAMEM_LAYOUT);
+}
+
+/*
+** Compiled layouts of format strings are cached in a table with weak
+** values, so they are shared by calls using the same format.
+*/
+#define LUAMEM_LAYOUTCACHE	"luamem_LayoutCache"
+
+static void pushlayoutcache (lua_State *L) {
+	if (!luaL_getsubtable(L, LUA_REGISTRYINDEX, LUAMEM_LAYOUTCACHE)) {
+		lua_createtable(L, 0, 1);
+		lua_pushliteral(L, "v");
+		lua_setfield(L, -2, "__mode");
+		lua_setmetatable(L, -2);
+	}
+}
+
+LUAMEMLIB_API luamem_Layout *luamem_checklayout (lua_State *L, int arg) {
+	luamem_Layout *layout = luamem_tolayout(L, arg);
+	if (!layout) {
+		const char *fmt = luaL_checkstring(L, arg);
+		arg = lua_absindex(L, arg);
+		pushlayoutcache(L);
+		lua_pushvalue(L, arg);
+		if (lua_rawget(L, -2) == LUA_TUSERDATA) {
+			layout = (luamem_Layout *)lua_touserdata(L, -1);
+		} else {
+			lua_pop(L, 1);  /* pop nil */
+			layout = luamem_newlayout(L, fmt);
+			lua_pushvalue(L, arg);  /* format */
+			lua_pushvalue(L, -2);  /* layout */
+			lua_rawset(L, -4);  /* cache[format] = layout */
+		}
+		lua_replace(L, arg);  /* keep layout alive while in use */
+		lua_pop(L, 1);  /* pop cache */
+	}
+	return layout;
+}
+
+LUAMEMLIB_API int luamem_layoutsize (const luamem_Layout *layout,
+                                     size_t *size) {
+	if (size) *size = layout->size;
+	return layout->fixed;
+}
+
+
+/* result of 'packvalue' when there is no room for the value */
+#define NOROOM	MAX_SIZET
+
+/*
+** Pack the value at 'arg' as described by 'op' in 'buff' that has
+** 'room' bytes available. Returns the number of bytes used, or NOROOM
+** if the value does not fit.
+*/
+static size_t packvalue (lua_State *L, const LayoutOp *op, int arg,
+                         char *buff, size_t room) {
+	size_t size = (size_t)op->size;
+	switch ((KOption)op->opt) {
+		case Kint: {  /* signed integers */
+			lua_Integer n = luaL_checkinteger(L, arg);
+			if (op->size < SZINT) {  /* need overflow check? */
+				lua_Integer lim = (lua_Integer)1 << ((op->size * NB) - 1);
+				luaL_argcheck(L, -lim <= n && n < lim, arg, "integer overflow");
+			}
+			if (size > room) return NOROOM;
+			packint(buff, (lua_Unsigned)n, op->islittle, op->size, (n < 0));
+			return size;
+		}
+		case Kuint: {  /* unsigned integers */
+			lua_Integer n = luaL_checkinteger(L, arg);
+			if (op->size < SZINT)  /* need overflow check? */
+				luaL_argcheck(L, (lua_Unsigned)n < ((lua_Unsigned)1 << (op->size * NB)),
+				                 arg, "unsigned overflow");
+			if (size > room) return NOROOM;
+			packint(buff, (lua_Unsigned)n, op->islittle, op->size, 0);
+			return size;
+		}
+		case Kfloat: {  /* floating-point options */
+			volatile Ftypes u;
+			lua_Number n = luaL_checknumber(L, arg);  /* get argument */
+			if (size > room) return NOROOM;
+			if (size == sizeof(u.f)) u.f = (float)n;  /* copy it into 'u' */
+			else if (size == sizeof(u.d)) u.d = (double)n;
+			else u.n = n;
+			/* move 'u' to final result, correcting endianness if needed */
+			copywithendian(buff, u.buff, op->size, op->islittle);
+			return size;
+		}
+		case Kchar: {  /* fixed-size string */
+			size_t len;
+			const char *s = luamem_checkarray(L, arg, &len);
+			luaL_argcheck(L, len == size, arg, "wrong length");
+			if (len > room) return NOROOM;
+			if (len > 0) memcpy(buff, s, len * sizeof(char));
+			return len;
+		}
+		case Kstring: {  /* strings with length count */
+			size_t len;
+			const char *s = luamem_checkarray(L, arg, &len);
+			luaL_argcheck(L, size >= sizeof(size_t) ||
+			                 len < ((size_t)1 << (size * NB)),
+			                 arg, "string length does not fit in given size");
+			if (size > room || len > room - size) return NOROOM;
+			packint(buff, (lua_Unsigned)len, op->islittle, op->size, 0);  /* pack length */
+			if (len > 0) memcpy(buff + size, s, len * sizeof(char));
+			return size + len;
+		}
+		case Kzstr: {  /* zero-terminated string */
+			size_t len;
+			const char *s = luamem_checkarray(L, arg, &len);
+			luaL_argcheck(L, memchr(s, '\0', len) == NULL, arg,
+			                 "string contains zeros");
+			if (len >= room) return NOROOM;
+			if (len > 0) memcpy(buff, s, len * sizeof(char));
+			buff[len] = '\0';
+			return len + 1;
+		}
+		default:  /* Kpadding, Kpaddalign */
+			return size > room ? NOROOM : size;
+	}
+}
+
+LUAMEMLIB_API int luamem_packlayout (lua_State *L,
+                                     const luamem_Layout *layout,
+                                     char *mem, size_t len,
+                                     size_t *pos, int *parg) {
+	const LayoutOp *op = layout->op;
+	const LayoutOp *end = op + layout->nops;
+	size_t i = *pos;
+	int arg = *parg;
+	if (i > len) return 0;
+	if (layout->fixed && ntoalign(i, layout->maxalign) == 0 &&
+	    layout->size <= len - i) {  /* all values fit? */
+		mem += i;
+		for (; op < end; op++) {
+			if (takesvalue(op->opt))
+				packvalue(L, op, arg++, mem + op->offset, MAX_SIZET);
+		}
+		*pos = i + layout->size;
+		*parg = arg;
+		return 1;
+	}
+	for (; op < end; op++) {
+		size_t skip = ntoalign(i, op->align);
+		size_t used;
+		if (skip > len - i) break;  /* no room for alignment */
+		i += skip;
+		used = packvalue(L, op, arg, mem + i, len - i);
+		if (used == NOROOM) break;
+		i += used;
+		if (takesvalue(op->opt)) arg++;
+	}
+	*pos = i;
+	*parg = arg;
+	return op == end;
+}
+
+
+LUAMEMLIB_API size_t luamem_packlayoutsize (lua_State *L,
+                                            const luamem_Layout *layout,
+                                            size_t pos, int arg) {
+	const LayoutOp *op = layout->op;
+	const LayoutOp *end = op + layout->nops;
+	for (; op < end; op++) {
+		size_t size = (size_t)op->size;
+		if (takesvalue(op->opt)) {
+			packvalue(L, op, arg, NULL, 0);  /* only checks the value */
+			if (op->opt == Kstring || op->opt == Kzstr) {
+				size_t len;
+				luamem_toarray(L, arg, &len);
+				size = op->opt == Kzstr ? len + 1 : size + len;
+			}
+			arg++;
+		}
+		size += ntoalign(pos, op->align);
+		if (l_unlikely(size > MAX_SIZET - pos))
+			luaL_error(L, "pack result too large");
+		pos += size;
+	}
+	return pos;
+}
+
+/*
+** Push the value described by 'op' from 'data' with 'room' bytes
+** available, and returns the number of bytes consumed.
+*/
+static size_t unpackvalue (lua_State *L, const LayoutOp *op,
+                           const char *data, size_t room) {
+	int size = op->size;
+	switch ((KOption)op->opt) {
+		case Kint:
+		case Kuint: {
+			lua_Integer res = unpackint(L, data, op->islittle, size,
+			                               (op->opt == Kint));
+			lua_pushinteger(L, res);
+			break;
+		}
+		case Kfloat: {
+			volatile Ftypes u;
+			lua_Number num;
+			copywithendian(u.buff, data, size, op->islittle);
+			if (size == sizeof(u.f)) num = (lua_Number)u.f;
+			else if (size == sizeof(u.d)) num = (lua_Number)u.d;
+			else num = u.n;
+			lua_pushnumber(L, num);
+			break;
+		}
+		case Kchar: {
+			lua_pushlstring(L, data, size);
+			break;
+		}
+		case Kstring: {
+			size_t len = (size_t)unpackint(L, data, op->islittle, size, 0);
+			if (len > room - size) luaL_argerror(L, 2, "data string too short");
+			lua_pushlstring(L, data + size, len);
+			return size + len;
+		}
+		case Kzstr: {
+			size_t len;
+			const char *z = (const char *)memchr(data, '\0', room);
+			if (z == NULL) luaL_argerror(L, 2, "unfinished string for format 'z'");
+			len = (size_t)(z - data);
+			lua_pushlstring(L, data, len);
+			return len + 1;  /* string plus final '\0' */
+		}
+		default: break;
+	}
+	return size;
+}
+
+/*
+** As in 'string.unpack', invalid data are reported as errors in argument
+** 2, the format of 'memory.unpack'.
+*/
+LUAMEMLIB_API int luamem_unpacklayout (lua_State *L,
+                                       const luamem_Layout *layout,
+                                       const char *data, size_t len,
+                                       size_t *ppos) {
+	const LayoutOp *op = layout->op;
+	const LayoutOp *end = op + layout->nops;
+	size_t pos = *ppos;
+	int n = 0;  /* number of results */
+	if (pos > len) luaL_argerror(L, 2, "data string too short");
+	if (layout->fixed && ntoalign(pos, layout->maxalign) == 0 &&
+	    layout->size <= len - pos) {  /* all values available? */
+		/* stack space for values + next position */
+		luaL_checkstack(L, layout->nvalues+1, "too many results");
+		data += pos;
+		for (; op < end; op++) {
+			if (takesvalue(op->opt)) {
+				unpackvalue(L, op, data + op->offset, MAX_SIZET);
+				n++;
+			}
+		}
+		*ppos = pos + layout->size;
+		return n;
+	}
+	for (; op < end; op++) {
+		size_t skip = ntoalign(pos, op->align);
+		if (skip + op->size > len - pos)
+			luaL_argerror(L, 2, "data string too short");
+		pos += skip;  /* skip alignment */
+		if (takesvalue(op->opt)) {
+			/* stack space for item + next position */
+			luaL_checkstack(L, 2, "too many results");
+			pos += unpackvalue(L, op, data + pos, len - pos);
+			n++;
+		}
+		else pos += op->size;
+	}
+	*ppos = pos;
+	return n;
+}
+
 /* }====================================================== */
@@ -5,6 +5,10 @@
 #include <lua.h>
 #include <lauxlib.h>
 
+#if defined(LUA_USE_POSIX)
+#include <sys/uio.h>
+#endif
+
 
 
 #ifndef LUAMEMLIB_API
@@ -35,6 +39,19 @@ LUAMEMLIB_API int (luamem_resetref) (lua_State *L, int idx,
 
 #define  luamem_setref(L,I,M,S,F) luamem_resetref(L,I,M,S,F,1)
 
+LUAMEMLIB_API char *(luamem_newview) (lua_State *L, int idx,
+                                      size_t offset, size_t len);
+
+LUAMEMLIB_API void (luamem_newring) (lua_State *L, size_t size, int mirror);
+LUAMEMLIB_API char *(luamem_ringspace) (lua_State *L, int idx, size_t need,
+                                        size_t *len);
+LUAMEMLIB_API size_t (luamem_produce) (lua_State *L, int idx, size_t n);
+LUAMEMLIB_API size_t (luamem_consume) (lua_State *L, int idx, size_t n);
+
+LUAMEMLIB_API size_t (luamem_capacity) (lua_State *L, int idx);
+LUAMEMLIB_API char *(luamem_growref) (lua_State *L, int idx, size_t len);
+LUAMEMLIB_API char *(luamem_reallocref) (lua_State *L, int idx, size_t cap);
+
 LUAMEMLIB_API int (luamem_type) (lua_State *L, int idx);
 
 #define luamem_ismemory(L,I)	(luamem_type(L,I) != LUAMEM_TNONE)
@@ -52,6 +69,16 @@ LUAMEMLIB_API const char *(luamem_asarray) (lua_State *L, int idx, size_t *len);
 LUAMEMLIB_API const char *(luamem_checkarray) (lua_State *L, int idx, size_t *len);
 LUAMEMLIB_API const char *(luamem_optarray) (lua_State *L, int arg, const char *def, size_t *len);
 
+#if defined(LUA_USE_POSIX)
+LUAMEMLIB_API int (luamem_toiovec) (lua_State *L, int idx, int n,
+                                    struct iovec *iov);
+#endif
+
+
+LUAMEMLIB_API void *(luamem_share) (lua_State *L, int idx);
+LUAMEMLIB_API void (luamem_attach) (lua_State *L, void *token);
+LUAMEMLIB_API void (luamem_unshare) (void *token);
+
 
 LUAMEMLIB_API void *(luamem_realloc) (lua_State *L, void *mem, size_t osize,
                                                                size_t nsize);
@@ -80,6 +107,64 @@ LUAMEMLIB_API size_t (luamem_checklenarg) (lua_State *L, int idx);
 
 LUAMEMLIB_API void (luamem_addvalue) (luaL_Buffer *B);
 
+typedef struct luamem_Buffer {
+	char *b;  /* buffer address */
+	size_t size;  /* buffer size */
+	size_t n;  /* number of characters in buffer */
+	lua_State *L;
+} luamem_Buffer;
+
+#define luamem_bufflen(bf)	((bf)->n)
+#define luamem_buffaddr(bf)	((bf)->b)
+
+#define luamem_addchar(B,c) \
+	((void)((B)->n < (B)->size || luamem_prepbuffsize((B), 1)), \
+	 ((B)->b[(B)->n++] = (c)))
+
+#define luamem_addsize(B,s)	((B)->n += (s))
+
+#define luamem_addstring(B,s)	luamem_addlstring((B), (s), strlen(s))
+
+LUAMEMLIB_API void (luamem_buffinit) (lua_State *L, luamem_Buffer *B);
+LUAMEMLIB_API char *(luamem_prepbuffsize) (luamem_Buffer *B, size_t sz);
+LUAMEMLIB_API void (luamem_addlstring) (luamem_Buffer *B, const char *s,
+                                        size_t l);
+LUAMEMLIB_API void (luamem_pushresult) (luamem_Buffer *B);
+LUAMEMLIB_API void (luamem_pushresultsize) (luamem_Buffer *B, size_t sz);
+LUAMEMLIB_API char *(luamem_buffinitsize) (lua_State *L, luamem_Buffer *B,
+                                           size_t sz);
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Pre-compiled pack/unpack layouts
+** =======================================================
+*/
+
+#define LUAMEM_LAYOUT	"luamem_Layout"
+
+typedef struct luamem_Layout luamem_Layout;
+
+LUAMEMLIB_API luamem_Layout *(luamem_newlayout) (lua_State *L,
+                                                 const char *fmt);
+LUAMEMLIB_API luamem_Layout *(luamem_tolayout) (lua_State *L, int idx);
+LUAMEMLIB_API luamem_Layout *(luamem_checklayout) (lua_State *L, int arg);
+LUAMEMLIB_API int (luamem_layoutsize) (const luamem_Layout *layout,
+                                       size_t *size);
+LUAMEMLIB_API int (luamem_packlayout) (lua_State *L,
+                                       const luamem_Layout *layout,
+                                       char *mem, size_t len,
+                                       size_t *pos, int *arg);
+LUAMEMLIB_API size_t (luamem_packlayoutsize) (lua_State *L,
+                                              const luamem_Layout *layout,
+                                              size_t pos, int arg);
+LUAMEMLIB_API int (luamem_unpacklayout) (lua_State *L,
+                                         const luamem_Layout *layout,
+                                         const char *mem, size_t len,
+                                         size_t *pos);
+
 /* }====================================================== */
 
 
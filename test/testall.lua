@@ -67,6 +67,18 @@ local function testpack(case, ...)
 				assert(tostring(mem) == expected)
 				pos = assertunpack({...}, memory.unpack(mem, format, index))
 				assert(pos == index+size)
+
+				local layout = memory.layout(format)
+				memory.fill(mem, 0)
+				ok, pos = layout:pack(mem, index, ...)
+				assert(ok == true)
+				assert(pos == index+size)
+				assert(tostring(mem) == expected)
+				pos = assertunpack({...}, layout:unpack(mem, index))
+				assert(pos == index+size)
+				pos = assertunpack({...}, memory.unpack(mem, layout, index))
+				assert(pos == index+size)
+
 				format, replaces = string.gsub(format, " ", "")
 			end
 
@@ -130,6 +142,18 @@ do print("memory.type(value)")
 	assert(memory.type(memory.create(10)) == "fixed")
 	assert(memory.type(memory.create("abc")) == "fixed")
 	assert(memory.type(memory.create("Lua Memory 1.0", 5, -5)) == "fixed")
+
+	-- metatables without the marks of this copy, as when created by another
+	for _, m in ipairs{memory.create(1), memory.create()} do
+		local mt = debug.getmetatable(m)
+		for k in pairs(mt) do
+			if type(k) == "userdata" then mt[k] = nil end
+		end
+	end
+	assert(memory.type(memory.create(10)) == "fixed")
+	assert(memory.type(memory.create()) == "resizable")
+	assert(memory.type(memory.create(10)) == "fixed")  -- marked again
+	assert(memory.type(io.stdout) == nil)
 end
 
 do print("memory<close>")
@@ -145,6 +169,707 @@ do print("memory<close>")
 	asserterr("index out of bounds", memory.set, b, 1, 255)
 end
 
+do print("memory.view(m [, i [, j]])")
+	asserterr("memory expected", memory.view, "abc")
+
+	local f = memory.create("0123456789")
+	local v = memory.view(f, 3, -3)
+	assert(memory.type(v) == "other")
+	assert(tostring(v) == "234567")
+	assert(tostring(memory.view(f)) == "0123456789")
+	assert(tostring(memory.view(f, 5, 4)) == "")
+	assert(tostring(memory.view(f, 20)) == "")
+	memory.set(v, 1, 0x41)
+	assert(tostring(f) == "01A3456789")
+	local vv = memory.view(v, 2, 3)
+	assert(tostring(vv) == "34")
+	memory.fill(vv, "x")
+	assert(tostring(f) == "01Axx56789")
+	assert(memory.capacity(vv) == 2)
+	asserterr("resizable memory expected", memory.resize, vv, 10)
+	do local closeable<close> = v end
+	assert(tostring(v) == "")
+	assert(tostring(vv) == "xx")
+
+	local m = memory.create()
+	memory.resize(m, 10, "0123456789")
+	local v = memory.view(m, 3, 6)
+	local vv = memory.view(v, 2)
+	assert(tostring(v) == "2345")
+	assert(tostring(vv) == "345")
+	memory.resize(m, 1000)
+	assert(tostring(v) == "2345")
+	assert(tostring(vv) == "345")
+	memory.resize(m, 5)
+	assert(tostring(v) == "")
+	assert(memory.len(vv) == 0)
+	assert(memory.get(v, 1) == nil)
+	asserterr("index out of bounds", memory.set, v, 1, 255)
+	memory.resize(m, 10, "abc")
+	assert(tostring(v) == "234a")
+	assert(tostring(vv) == "34a")
+	do local closeable<close> = m end
+	assert(tostring(v) == "")
+	assert(tostring(vv) == "")
+end
+
+do print("memory.rep(s, n)")
+	for _, S in ipairs({tostring, memory.create}) do
+		for _, n in ipairs{ 0, 1, 2, 3, 17, 1000, 40000 } do
+			for _, s in ipairs{ "", "a", "ab", "abc", "0123456789ABCDEF", "0123456789ABCDEF\0" } do
+				local m = memory.rep(S(s), n)
+				assert(memory.type(m) == "fixed")
+				assert(memory.diff(m, string.rep(s, n)) == nil)
+			end
+		end
+	end
+	assert(memory.len(memory.rep("abc", -1)) == 0)
+	asserterr("resulting memory too large", memory.rep, "abc", math.maxinteger)
+	asserterr("string or memory expected", memory.rep, {}, 1)
+end
+
+do print("memory.ring(size [, mirror]), memory.produce(r, s [, i [, j]]), memory.consume(r [, n])")
+	asserterr("invalid size", memory.ring, 0)
+	asserterr("ring expected", memory.produce, memory.create(8), "abc")
+	asserterr("ring expected", memory.consume, memory.create(8))
+
+	for _, mirror in ipairs{ false, true } do
+		local r = memory.ring(8, mirror)
+		local size = memory.capacity(r)
+		local mirrored = size > 8
+		assert(mirror or not mirrored)
+		assert(memory.type(r) == "other")
+		assert(memory.len(r) == 0)
+		asserterr("resizable memory expected", memory.resize, r, 10)
+
+		assert(memory.produce(r, "abc") == 3)
+		assert(tostring(r) == "abc")
+		assert(memory.consume(r, 2) == 2)
+		assert(tostring(r) == "c")
+		assert(memory.produce(r, string.rep("x", size+10)) == size-1)
+		assert(memory.len(r) == size)
+		assert(memory.produce(r, "z") == 0)
+		assertret({1, 2}, memory.find(r, "cx"))
+
+		local v = memory.view(r, 1, 2)
+		assert(tostring(v) == "cx")
+		assert(memory.consume(r, size-2) == size-2)
+		assert(tostring(v) == "xx")
+		assert(memory.produce(r, "0123456789", 3, -4) == 5)
+		assert(tostring(r) == "xx23456")
+		assertret({"xx", "234", 6}, memory.unpack(r, "c2c3"))
+		if mirrored then
+			assert(memory.produce(r, r) == 7)
+			assert(tostring(r) == "xx23456xx23456")
+		else
+			assert(memory.produce(r, r) == 1)
+			assert(tostring(r) == "xx23456x")
+		end
+		assert(memory.consume(r, 100) == (mirrored and 14 or 8))
+		assert(memory.len(r) == 0)
+		assert(tostring(v) == "")
+		assert(memory.produce(r, "hello") == 5)
+		assert(memory.consume(r) == 5)
+		assert(memory.consume(r) == 0)
+	end
+
+	local r = memory.ring(4096, true)
+	for i = 1, 10 do  -- wraps around the end of the buffer
+		local s = string.rep(string.char(0x40+i), 3000)
+		assert(memory.produce(r, s) == 3000)
+		assert(tostring(r) == s)
+		assert(memory.consume(r, 2999) == 2999)
+		assert(memory.consume(r, 1) == 1)
+	end
+	do local closeable<close> = r end
+	assert(memory.len(r) == 0)
+end
+
+do print("memory.array(m, type [, i [, j]])")
+	local m = memory.create("\1\2\255\0z")
+	local a = memory.array(m, "u8")
+	assert(#a == 5)
+	assert(a[3] == 255)
+	assert(a[0] == nil and a[6] == nil and a[1.5] == nil)
+	assert(a:sum() == 1+2+255+0+122)
+	assert(a:min() == 0)
+	assert(a:max() == 255)
+	a[2] = 7
+	assert(tostring(m) == "\1\7\255\0z")
+	asserterr("value out of range", function () a[2] = 256 end)
+	asserterr("index out of bounds", function () a[6] = 1 end)
+
+	local a = memory.array(m, "i8", 3, 4)
+	assert(#a == 2 and a[1] == -1)
+	asserterr("value out of range", function () a[1] = 128 end)
+	a[1] = -128
+	assert(a[1] == -128)
+
+	local m = memory.create(8)
+	local le, be = memory.array(m, "<i16"), memory.array(m, ">i16")
+	assert(#le == 4 and #be == 4)
+	le[1] = 0x0102
+	assert(tostring(m) == "\2\1\0\0\0\0\0\0")
+	assert(be[1] == 0x0201)
+	be[2] = -2
+	assert(be:sum() == 0x0201-2)
+	assert(be:min() == -2 and be:max() == 0x0201)
+	assert(be:scale(2) == be)
+	assert(tostring(m) == "\4\2\255\252\0\0\0\0")
+	assert(be:add(1) == be)
+	assert(tostring(m) == "\4\3\255\253\0\1\0\1")
+
+	local o = memory.array(memory.create(8), "<i16")
+	for i = 1, #o do o[i] = 10*i end
+	assert(be:dot(o) == 0x0403*10 + (-3)*20 + 30 + 40)
+	o:add(be)
+	assert(o[1] == 10+0x0403 and o[2] == 20-3)
+	asserterr("array of same type and length expected", o.add, o, memory.array(m, "u16"))
+	asserterr("array of same type and length expected", o.dot, o, memory.array(m, "i16", 1, 6))
+
+	for _, type in ipairs{ "i8", "u8", "i16", "u16", "i32", "u32", "i64", "u64", "f32", "f64", ">i32", "<u64", ">f64" } do
+		local a = memory.array(memory.create(8000), type)
+		local sum = 0
+		for i = 1, #a do
+			a[i] = (i*7)%100
+			sum = sum+a[i]
+		end
+		assert(a:sum() == sum)
+		assert(a:min() == 0 and a:max() == 99)
+		if #a < 8000 then
+			a:scale(2):add(a)
+			assert(a:sum() == 4*sum)
+			assert(a[3] == 84)
+		end
+	end
+
+	local a = memory.array(memory.create(8), "f32")
+	a[1], a[2] = 1.5, -0.25
+	assert(math.type(a:sum()) == "float" and a:sum() == 1.25)
+	a:scale(.5)
+	assert(a[1] == .75)
+	local a = memory.array(memory.create(8), "u64")
+	a[1] = -1
+	assert(a[1] == -1)
+
+	local m = memory.create()
+	memory.resize(m, 16)
+	local a = memory.array(m, "u32", 5)
+	assert(#a == 3)
+	memory.resize(m, 8)
+	assert(#a == 0 and a[1] == nil)
+	assert(a:sum() == 0 and a:min() == nil)
+	memory.resize(m, 20)
+	assert(#a == 3)
+
+	asserterr("invalid element type 'i12'", memory.array, m, "i12")
+	asserterr("memory expected", memory.array, "abc", "u8")
+end
+
+do print("memory.crc32(m [, i [, j [, c]]]), memory.crc32c(...), memory.xxhash64(...)")
+	for _, S in ipairs{ tostring, memory.create } do
+		assert(memory.crc32(S"123456789") == 0xcbf43926)
+		assert(memory.crc32c(S"123456789") == 0xe3069283)
+		assert(memory.crc32(S"") == 0)
+		assert(memory.crc32(S"xx123456789", 3) == 0xcbf43926)
+		assert(memory.crc32(S"6789", 1, -1, memory.crc32(S"12345")) == 0xcbf43926)
+		assert(memory.crc32c(S"6789", 1, -1, memory.crc32c(S"12345")) == 0xe3069283)
+		assert(memory.xxhash64(S"") == 0xef46db3751d8e999)
+		assert(memory.xxhash64(S"abc") == 0x44bc2cf5ad770999)
+		assert(memory.xxhash64(S"Nobody inspects the spammish repetition") == 0xfbcea83c8a378bf1)
+	end
+
+	local data = {}
+	for i = 1, 5000 do data[i] = string.char((i*7919)%256) end
+	local m = memory.create(table.concat(data))
+	for _, n in ipairs{ 1, 5, 31, 32, 33, 100, 250 } do
+		local state = memory.xxhash64state(99)
+		local crc, crcc, hash = 0, 0
+		for i = 1, memory.len(m), n do
+			crc = memory.crc32(m, i, i+n-1, crc)
+			crcc = memory.crc32c(m, i, i+n-1, crcc)
+			hash = memory.xxhash64(m, i, i+n-1, state)
+		end
+		assert(crc == memory.crc32(m))
+		assert(crcc == memory.crc32c(m))
+		assert(hash == memory.xxhash64(m, 1, -1, 99))
+	end
+	assert(memory.xxhash64(m, 1, 0, memory.xxhash64state()) == memory.xxhash64(""))
+
+	asserterr("number expected", memory.xxhash64, "abc", 1, -1, "x")
+	asserterr("string or memory expected", memory.crc32, {})
+end
+
+do print("memory.encode(m, i, s, si, sj, codec), memory.decode(...), memory.encodelen(n, codec), memory.decodelen(s, i, j, codec)")
+	local function check(data, codec, encoded)
+		assert(memory.encodelen(#data, codec) == #encoded)
+		assert(memory.decodelen(encoded, nil, nil, codec) == #data)
+		for _, S in ipairs{ tostring, memory.create } do
+			local m = memory.create(#encoded)
+			assertret({ #encoded+1, #data+1 }, memory.encode(m, 1, S(data), nil, nil, codec))
+			assert(tostring(m) == encoded)
+			local m = memory.create(#data)
+			assertret({ #data+1, #encoded+1 }, memory.decode(m, 1, S(encoded), nil, nil, codec))
+			assert(tostring(m) == data)
+		end
+	end
+	check("", "base64", "")
+	check("f", "base64", "Zg==")
+	check("fo", "base64", "Zm8=")
+	check("foo", "base64", "Zm9v")
+	check("foob", "base64", "Zm9vYg==")
+	check("fooba", "base64", "Zm9vYmE=")
+	check("foobar", "base64", "Zm9vYmFy")
+	check("f", "base64url", "Zg")
+	check("fooba", "base64url", "Zm9vYmE")
+	check("\xfb\xff", "base64", "+/8=")
+	check("\xfb\xff", "base64url", "-_8")
+	check("foobar", "hex", "666f6f626172")
+	check("\0\1\127\128\254\255XYZ0123456789abcdefghi",
+	      "hex", "00017f80feff58595a30313233343536373839616263646566676869")
+
+	local m = memory.create(5)
+	assertret({ 5, 4 }, memory.encode(m, 1, "foobar", nil, nil, "base64"))
+	assert(memory.tostring(m, 1, 4) == "Zm9v")
+	assertret({ 6, 3 }, memory.encode(m, 2, "fo", nil, nil, "base64"))
+	assertret({ 5, 3 }, memory.encode(m, 1, "foobar", nil, nil, "hex"))
+	assertret({ 4, 5 }, memory.decode(m, 1, "Zm9vYmFyZg==", nil, nil, "base64"))
+	assert(memory.tostring(m, 1, 3) == "foo")
+	assertret({ 4, 1 }, memory.decode(m, 4, "Zm9vYmFyZg==", nil, nil, "base64"))
+	assertret({ 5, 5 }, memory.decode(m, 3, "4A4b", nil, nil, "hex"))
+	assert(memory.tostring(m, 3, 4) == "JK")
+	assertret({ 5, 7 }, memory.decode(m, 3, "xxZm9=", 3, -1, "base64url"))
+	assert(memory.tostring(m, 3, 4) == "fo")
+
+	for _, codec in ipairs{ "hex", "base64", "base64url" } do
+		for n = 0, 100, 7 do
+			local data = memory.create(n)
+			for i = 1, n do memory.set(data, i, (i*7919)%256) end
+			local encoded = memory.create(memory.encodelen(n, codec))
+			memory.encode(encoded, 1, data, nil, nil, codec)
+			local decoded = memory.create(n)
+			memory.decode(decoded, 1, encoded, nil, nil, codec)
+			assert(memory.diff(decoded, data) == nil)
+		end
+	end
+
+	local m = memory.create(9)
+	asserterr("invalid hex data (at position 3)", memory.decode, m, 1, "4A4", nil, nil, "hex")
+	asserterr("invalid hex data (at position 2)", memory.decode, m, 1, "4g4b", nil, nil, "hex")
+	asserterr("invalid base64 data (at position 5)", memory.decode, m, 1, "Zm9v!", nil, nil, "base64")
+	asserterr("invalid base64 data (at position 3)", memory.decode, m, 1, "Zm=v", nil, nil, "base64")
+	asserterr("invalid base64 data (at position 3)", memory.decodelen, "Zg=", nil, nil, "base64")
+	asserterr("invalid option 'xx'", memory.encode, m, 1, "Zg", nil, nil, "xx")
+	asserterr("index out of bounds", memory.encode, m, 11, "Zg", nil, nil, "hex")
+	asserterr("memory expected", memory.decode, "x", 1, "4A4b", nil, nil, "hex")
+	asserterr("resulting memory too large", memory.encodelen, maxi, "hex")
+end
+
+do print("memory.findpattern(m, p [, i [, j [, strings]]]), memory.match(...), memory.gmatch(...)")
+	for _, S in ipairs{ tostring, memory.create } do
+		local m = S"key=value; other = 42;"
+		assertret({ 1, 3, 5, 9 }, memory.match(m, "(%w+)=(%w+)"))
+		assertret({ "key", "value" }, memory.match(m, "(%w+)=(%w+)", nil, nil, true))
+		assertret({ 20, 21 }, memory.match(m, "%d+"))
+		assertret({ "42" }, memory.match(m, "%d+", 1, -1, true))
+		assertret({ 20, 20 }, memory.match(m, "%d+$", 1, 20))
+		assertret({ 11, 12 }, memory.match(m, "()%s*()", 11))
+		assert(memory.match(m, "%d+", 1, 19) == nil)
+		assertret({ 12, 16, 12, 16 }, memory.findpattern(m, "(o%w+)"))
+		assertret({ 12, 16, "other" }, memory.findpattern(m, "(o%w+)", 1, -1, true))
+		assertret({ 4, 4 }, memory.findpattern(m, "="))
+		assertret({ 12, 12 }, memory.findpattern(m, "^o", 12))
+		assert(memory.findpattern(m, "^o", 11) == nil)
+		assert(memory.findpattern(m, "", 30) == nil)
+		assertret({ 23, 22 }, memory.findpattern(m, "$", 23))
+
+		local m = S"(a(b)"
+		assertret({ 3, 5 }, memory.match(m, "%b()"))
+		assert(memory.match(m, "%b()", 6) == nil)
+		assertret({ 6 }, memory.match(m, "%f[\0]()"))
+		assertret({ 2, 2 }, memory.match(m, "%f[%w]%w", 2, 2))
+		assert(memory.match(m, "(a)%1") == nil)
+		asserterr("malformed pattern (missing ']')", memory.match, m, "[a")
+		asserterr("malformed pattern (ends with '%')", memory.match, m, "%")
+		asserterr("unfinished capture", memory.match, m, "(()")
+
+		local m = S"one two  three"
+		local expected = { 1, 3, 5, 7, 10, 14 }
+		for i, j in memory.gmatch(m, "%a+") do
+			assert(i == table.remove(expected, 1))
+			assert(j == table.remove(expected, 1))
+		end
+		assert(#expected == 0)
+		local expected = { "one", "two", "", "three" }
+		for s in memory.gmatch(m, "%a*", nil, nil, true) do
+			assert(s == table.remove(expected, 1))
+		end
+		assert(#expected == 0)
+		local expected = { "wo", "thr" }
+		for s in memory.gmatch(m, "%a+", 6, 12, true) do
+			assert(s == table.remove(expected, 1))
+		end
+		assert(#expected == 0)
+	end
+
+	local m = memory.create()
+	memory.resize(m, 6, "ab cd ")
+	local next = memory.gmatch(m, "%a+", 1, -1, true)
+	assert(next() == "ab")
+	memory.resize(m, 4)
+	assert(next() == "c")
+	assert(next() == nil)
+	asserterr("string expected", memory.match, m, m)
+end
+
+do print("memory.split(m, sep [, i [, j]])")
+	local function fields(...)
+		local list = {}
+		for i, j in memory.split(...) do
+			list[#list+1] = i
+			list[#list+1] = j
+		end
+		return list
+	end
+	local function same(expected, actual)
+		assert(#expected == #actual)
+		for i, v in ipairs(expected) do assert(actual[i] == v) end
+	end
+	for _, S in ipairs{ tostring, memory.create } do
+		local m = S"a,bc,,d,"
+		same({ 1,1, 3,4, 6,5, 7,7, 9,8 }, fields(m, ","))
+		same({ 1,1, 3,4, 6,5, 7,7, 9,8 }, fields(m, memory.create(",")))
+		same({ 1,1, 3,4, 6,5, 7,7, 9,8 }, fields(m, memory.searcher(",")))
+		same({ 3,4, 6,5, 7,6 }, fields(m, ",", 3, 6))
+		same({ 3,2 }, fields(m, ",", 3, 2))
+		same({ 1,8 }, fields(m, ",,,"))
+		same({ 1,1, 4,4, 7,6, 9,9 }, fields(S"x\r\ny\r\n\r\nz", "\r\n"))
+		same({ 1,0 }, fields(S"", ","))
+		asserterr("empty separator", memory.split, m, "")
+		asserterr("string or memory expected", memory.split, m)
+	end
+
+	local m = memory.create()
+	memory.resize(m, 6, "ab,cd,")
+	local next = memory.split(m, ",")
+	assertret({ 1, 2 }, next())
+	memory.resize(m, 4)
+	assertret({ 4, 4 }, next())
+	assertret({}, next())
+end
+
+do print("memory.findbyte(m, set [, i [, j]])")
+	for _, S in ipairs{ tostring, memory.create } do
+		local m = S"key = value;\r\n"
+		assert(memory.findbyte(m, "=;") == 5)
+		assert(memory.findbyte(m, S"=;", 6) == 12)
+		assert(memory.findbyte(m, "\r\n", -2) == 13)
+		assert(memory.findbyte(m, "=;", 6, 11) == nil)
+		assert(memory.findbyte(m, "") == nil)
+		assert(memory.findbyte(m, "=", 6, 5) == nil)
+		assert(memory.skipbytes(m, "abcdefghijklmnopqrstuvwxyz") == 4)
+		assert(memory.skipbytes(m, " =", 4) == 7)
+		assert(memory.skipbytes(m, "") == 1)
+		assert(memory.skipbytes(S"   ", " ") == nil)
+		asserterr("string or memory expected", memory.findbyte, m)
+		asserterr("string or memory expected", memory.skipbytes, nil, " ")
+	end
+
+	local digits = "0123456789abcdefABCDEF"
+	for size = 0, 100 do
+		local s = string.rep("x", size).."7"..string.rep("\xff", size)
+		assert(memory.findbyte(s, digits) == size+1)
+		assert(memory.findbyte(s, "\xff") == (size > 0 and size+2 or nil))
+		assert(memory.findbyte(s, "\0\xff\x80\x7f") == (size > 0 and size+2 or nil))
+		assert(memory.skipbytes(s, "x") == size+1)
+		assert(memory.skipbytes(s, "x"..digits) == (size > 0 and size+2 or nil))
+		assert(memory.findbyte(s, "yz") == nil)
+	end
+end
+
+do print("memory.builder([r])")
+	local r = memory.create()
+	assertret({false, 1, 0x0605}, memory.pack(r, "<i2", 1, 0x0605))  -- no growth
+	assert(memory.len(r) == 0)
+	local b = memory.builder(r)
+	b:pack("<i4i2", 0x04030201, 0x0605)
+	assert(tostring(r) == "\1\2\3\4\5\6")
+	b:pack("s1z", "abc", "xy")
+	assert(tostring(r) == "\1\2\3\4\5\6\3abcxy\0")
+	b:pack("!4 bXi4", 9)
+	assert(tostring(r) == "\1\2\3\4\5\6\3abcxy\0\9\0\0")
+	b:pack(memory.layout("<I4"), 0x44434241)
+	assert(tostring(r) == "\1\2\3\4\5\6\3abcxy\0\9\0\0ABCD")
+	asserterr("number expected", b.pack, b, "i2i2", 1, "x")
+	asserterr("overflow", b.pack, b, "i1", 300)
+	asserterr("string contains zeros", b.pack, b, "i4z", 1, "a\0b")
+	asserterr("wrong length", b.pack, b, "c3", "ab")
+	assert(tostring(r) == "\1\2\3\4\5\6\3abcxy\0\9\0\0ABCD")  -- unchanged
+	assertret({true, 5}, memory.pack(r, "s1", 1, "abc"))
+	assert(tostring(r) == "\3abc\5\6\3abcxy\0\9\0\0ABCD")
+
+	local b = memory.builder()
+	assert(#b == 0)
+	assert(tostring(b) == "")
+	b:add("head:")
+	b:add("0123456789", 3, 5)
+	b:pack(">I2s1", 0x4142, "xyz")
+	b:pack(memory.layout("z"), "end")
+	assert(tostring(b) == "head:234AB\3xyzend\0")
+	b:addint(-2, 2)
+	b:addint(1)
+	b:adddouble(0.5)
+	assert(#b == 18+2+8+8)
+	local m = b:memory()
+	assert(memory.type(m) == "resizable")
+	assertret({-2, 1, 0.5, 37}, memory.unpack(m, "=i2i8d", 19))
+	b:add(m, 1, 5)
+	assert(#b == 41)
+	assert(tostring(m):sub(-5) == "head:")
+	asserterr("overflow", b.addint, b, 300, 1)
+	asserterr("invalid size", b.addint, b, 1, 3)
+	asserterr("number expected", b.adddouble, b, "x")
+	asserterr("string or memory expected", b.add, b, nil)
+	assert(#b == 41)
+
+	memory.builder(r):add("EF")
+	assert(tostring(r) == "\3abc\5\6\3abcxy\0\9\0\0ABCDEF")
+	asserterr("resizable memory expected", memory.builder, memory.create(3))
+	asserterr("resizable memory expected", memory.builder, "abc")
+end
+
+do print("memory.tostring(m, i, j, 'move'), memory.freeze(m)")
+	local m = memory.create()
+	memory.resize(m, 100, "0123456789")
+	assert(memory.tostring(m, 3, 5, "move") == "234")
+	assert(memory.len(m) == 0)
+	assert(memory.capacity(m) == 0)
+	assert(memory.type(m) == "resizable")
+
+	memory.resize(m, 10, "abc")
+	assert(memory.freeze(m) == "abcabcabca")
+	assert(memory.len(m) == 0)
+	assert(memory.freeze(m) == "")
+	memory.resize(m, 4, "xy")
+	assert(memory.tostring(m, 3, 2, "move") == "")
+	assert(memory.len(m) == 0)
+	memory.resize(m, 4, "xy")
+	assert(memory.tostring(m, nil, nil, "copy") == "xyxy")
+	assert(memory.len(m) == 4)
+	asserterr("invalid option", memory.tostring, m, 1, -1, "steal")
+
+	local b = memory.builder()
+	b:add(string.rep("x", 1000))
+	assert(memory.freeze(b:memory()) == string.rep("x", 1000))
+	assert(#b == 0)
+
+	asserterr("resizable memory expected", memory.tostring, memory.create("abc"), 1, -1, "move")
+	asserterr("resizable memory expected", memory.freeze, memory.create("abc"))
+	asserterr("resizable memory expected", memory.freeze, "abc")
+end
+
+do print("memory.map(path [, mode [, offset [, length]]])")
+	local path = os.tmpname()
+	local file = assert(io.open(path, "wb"))
+	assert(file:write(string.rep("0123456789", 1000)))
+	file:close()
+
+	local m = assert(memory.map(path))
+	assert(memory.type(m) == "other")
+	assert(memory.len(m) == 10000)
+	assertret({4, 6}, memory.find(m, "345"))
+	assertret({9994, 9996}, memory.rfind(m, "345"))
+	asserterr("read-only memory", memory.set, m, 1, 0x41)
+	asserterr("read-only memory", memory.fill, m, "x")
+	asserterr("read-only memory", memory.bnot, memory.view(m, 2, 4))
+	asserterr("read-only memory", memory.pack, m, "b", 1, 0)
+	local a = memory.array(m, "u8", 1, 4)
+	assert(a[1] == 0x30)
+	asserterr("read-only memory", function () a[1] = 0 end)
+	assert(memory.get(m, 1) == 0x30)
+	assert(memory.sync(m) == true)
+	assert(memory.advise(m, "sequential") == true)
+	asserterr("invalid option", memory.advise, m, "always")
+	do local closeable<close> = m end
+	assert(memory.len(m) == 0)
+
+	local m = assert(memory.map(path, "w", 4097, 3))
+	assert(tostring(m) == "789")
+	memory.fill(m, "x")
+	assert(memory.sync(m) == true)
+	assert(memory.len(memory.map(path, "r", 10000)) == 0)
+	asserterr("offset out of bounds", memory.map, path, "r", 10001)
+	asserterr("length out of bounds", memory.map, path, "r", 1, 10000)
+	asserterr("invalid option", memory.map, path, "rw")
+	asserterr("mapped memory expected", memory.sync, memory.create(3))
+	do local closeable<close> = m end
+
+	local file = assert(io.open(path, "rb"))
+	local contents = file:read("a")
+	file:close()
+	assert(contents:sub(1, 10) == "0123456789")
+	assert(contents:sub(4097, 4101) == "6xxx0")
+
+	assert(os.remove(path))
+	local ok, err = memory.map(path)
+	assert(ok == nil)
+	assert(string.find(err, path, 1, true) ~= nil)
+end
+
+do print("memory.share(m [, name]), memory.attach(handle), memory.unshare(handle)")
+	local handle = memory.share("hello")
+	assert(type(handle) == "userdata")
+	local m = memory.attach(handle)
+	assert(memory.type(m) == "other")
+	assert(tostring(m) == "hello")
+	asserterr("resizable memory expected", memory.resize, m, 10)
+
+	local other = memory.attach(memory.share(m))  -- same contents
+	memory.set(other, 1, 0x4a)
+	assert(tostring(m) == "Jello")
+	do local closeable<close> = m end
+	assert(memory.len(m) == 0)
+	assert(tostring(other) == "Jello")
+
+	assert(tostring(memory.attach(memory.share(3))) == "\0\0\0")
+	assert(tostring(memory.attach(memory.share(""))) == "")
+	assert(memory.unshare(memory.share("discarded")) == nil)
+	asserterr("luamem_SharedHandle expected", memory.attach, 1)
+	asserterr("luamem_SharedHandle expected", memory.attach, io.stdout)
+	asserterr("luamem_SharedHandle expected", memory.unshare, memory.create(1))
+
+	local handle = memory.share("twice")
+	local m1 = memory.attach(handle)
+	local m2 = memory.attach(handle)  -- attach does not consume the handle
+	memory.set(m1, 1, 0x54)
+	assert(tostring(m2) == "Twice")
+	assert(memory.unshare(handle) == nil)
+	assert(memory.unshare(handle) == nil)  -- no effect once unshared
+	asserterr("unshared handle", memory.attach, handle)
+	assert(tostring(m1) == "Twice")
+	m1 = nil
+	collectgarbage()
+	assert(tostring(m2) == "Twice")
+	m2 = nil
+	collectgarbage()
+
+	local handle = memory.share("collected")
+	local m = memory.attach(handle)
+	handle = nil
+	collectgarbage()  -- releases the reference of the handle only
+	assert(tostring(m) == "collected")
+	for _ = 1, 100 do memory.share(1024) end  -- never attached
+	collectgarbage()
+	asserterr("string or memory expected", memory.share, {})
+
+	local name = "/luamem-test-"..tostring(os.time())
+	assert(memory.share("named", name) == name)
+	local ok, err = memory.share("again", name)
+	assert(ok == nil and string.find(err, name, 1, true) == 1)
+	local m1 = assert(memory.attach(name))
+	local m2 = assert(memory.attach(name))
+	assert(tostring(m1) == "named")
+	memory.set(m1, 1, 0x4e)
+	assert(tostring(m2) == "Named")
+	assert(memory.sync(m1) == true)
+	assert(memory.unshare(name) == true)
+	assert(memory.unshare(name) == nil)
+	assert(memory.attach(name) == nil)
+	assert(tostring(m2) == "Named")
+end
+
+do print("memory.atomic(m, i, type)")
+	local m = memory.create(16)
+	local a = memory.atomic(m, 1, "u32")
+	assert(a:load() == 0)
+	a:store(7)
+	assert(a:load("acquire") == 7)
+	assert(a:add(5) == 7)
+	assert(a:sub(20, "relaxed") == 12)
+	assert(a:load() == 0xfffffff8)
+	assert(a:exchange(1, "acq_rel") == 0xfffffff8)
+	assertret({false, 1}, a:cas(2, 3))
+	assertret({true, 1}, a:cas(1, 3, "release"))
+	assert(memory.unpack(m, "=I4") == 3)
+	asserterr("value out of range", a.store, a, -1)
+	asserterr("value out of range", a.store, a, 1<<32)
+	asserterr("invalid order", a.store, a, 1, "acquire")
+	asserterr("invalid order", a.load, a, "release")
+	asserterr("invalid order", a.load, a, "acq_rel")
+	asserterr("invalid option", a.load, a, "bogus")
+
+	local b = memory.atomic(m, -8, "u64")
+	b:store(-1, "release")
+	assert(b:add(2) == -1)
+	assert(b:load() == 1)
+	assert(memory.unpack(m, "=i8", 9) == 1)
+
+	asserterr("unaligned atomic", memory.atomic, m, 2, "u32")
+	asserterr("index out of bounds", memory.atomic, m, 13, "u64")
+	asserterr("invalid option", memory.atomic, m, 1, "i32")
+	asserterr("memory expected", memory.atomic, "abcd", 1, "u32")
+
+	local r = memory.create()
+	memory.resize(r, 8)
+	local c = memory.atomic(r, 5, "u32")
+	c:store(1)
+	memory.resize(r, 4)
+	asserterr("atomic beyond memory", c.load, c)
+
+	local s = memory.attach(memory.share(8))
+	local counter = memory.atomic(memory.attach(memory.share(s)), 1, "u64")
+	counter:add(10)
+	assert(memory.atomic(s, 1, "u64"):load() == 10)
+end
+
+do print("memory.read(m, f [, i [, j]]), memory.write(m, f [, i [, j]])")
+	local file = io.tmpfile()
+	assert(memory.write("0123456789", file) == 10)
+	assert(memory.write(memory.create("0123456789"), file, 3, 5) == 3)
+	assert(memory.write("", file) == 0)
+	assert(memory.pwrite("AB", file, 1) == 2)
+	assert(file:seek("set") == 0)
+
+	local m = memory.create(8)
+	assert(memory.read(m, file, 3, 4) == 2)
+	assert(tostring(m) == "\0\0000A\0\0\0\0")
+	assert(memory.read(m, file) == 8)
+	assert(tostring(m) == "B3456789")
+	assert(memory.read(m, file) == 3)
+	assert(tostring(m) == "23456789")
+	assert(memory.read(m, file) == 0)
+	assert(memory.pread(m, file, 10, 2, 3) == 2)
+	assert(tostring(m) == "22356789")
+	assert(memory.pread(m, file, 13) == 0)
+
+	asserterr("memory expected", memory.read, "abc", file)
+	asserterr("invalid offset", memory.pread, m, file, -1)
+	asserterr("invalid file descriptor", memory.read, m, -1)
+	file:close()
+	asserterr("attempt to use a closed file", memory.read, m, file)
+end
+
+do print("memory.readv(f, ...), memory.writev(f, ...)")
+	local file = io.tmpfile()
+	local header = memory.create("HEADER")
+	assert(memory.writev(file, header, "-body-", header, 2, 3, "trailer", -3) == 17)
+	assert(memory.writev(file) == 0)
+	assert(file:seek("set") == 0)
+	assert(file:read("a") == "HEADER-body-EAler")
+
+	local m1, m2 = memory.create(4), memory.create(4)
+	assert(memory.readv(file, m1, m2, 2, 3) == 0)
+	assert(memory.pwrite("0123456789", file, 0) == 10)
+	assert(file:seek("set") == 0)
+	assert(memory.readv(file, m1, m2, 2, 3, m1, -1) == 7)
+	assert(tostring(m1) == "0126")
+	assert(tostring(m2) == "\00045\0")
+	asserterr("memory expected", memory.readv, file, "abc")
+	asserterr("string or memory expected", memory.writev, file, m1, true)
+	asserterr("invalid file descriptor", memory.writev, -1, m1)
+	file:close()
+end
+
 do print("memory..memory")
 	local b1 = memory.create("abc")
 	local b2 = memory.create("def")
@@ -223,6 +948,36 @@ for kind, newmem in pairs{fixedsize=memory.create, resizable=newresizable} do
 		assert(memory.tostring(b) == "\xe4l\0uó\xe4l\0u")
 	end
 
+	do print(kind, "memory.totable(m [, i [, j [, t [, ti]]]]), memory.fromtable(m, i, t [, ti [, tj]])")
+		local b = newmem("\1\2\255\0z")
+		local t = memory.totable(b)
+		assertret({1,2,255,0,122}, table.unpack(t))
+		assert(memory.totable(b, 2, 3, t, 10) == t)
+		assert(t[10] == 2 and t[11] == 255 and t[12] == nil)
+		assert(#memory.totable(b, 4, 2) == 0)
+		assertret({0,122}, table.unpack(memory.totable(b, -2)))
+		asserterr("too many elements", memory.totable, b, 1, 2, t, math.maxinteger)
+		asserterr("table expected", memory.totable, b, 1, -1, "x")
+		asserterr("memory expected", memory.totable, "abc")
+
+		local t = { 97, 98, 99, 100 }
+		memory.fromtable(b, 1, t)
+		assert(tostring(b) == "abcdz")
+		memory.fromtable(b, -2, t, 2, 3)
+		assert(tostring(b) == "abcbc")
+		memory.fromtable(b, 4, t)
+		assert(tostring(b) == "abcab")
+		memory.fromtable(b, 1, t, 3, 2)
+		assert(tostring(b) == "abcab")
+		memory.fromtable(b, 1, memory.totable(newmem("xyz")))
+		assert(tostring(b) == "xyzab")
+		asserterr("invalid value (at index 0) in table", memory.fromtable, b, 1, t, 0)
+		asserterr("invalid value (at index 2) in table", memory.fromtable, b, 1, {1, 256})
+		asserterr("invalid value (at index 1) in table", memory.fromtable, b, 1, {1.5})
+		asserterr("index out of bounds", memory.fromtable, b, 6, t)
+		asserterr("table expected", memory.fromtable, b, 1, "abc")
+	end
+
 	do print(kind, "memory.create(string), memory.diff, memory.len, #memory")
 		local function check(data, str, expi, explt)
 			local b = memory.create(data)
@@ -251,6 +1006,41 @@ for kind, newmem in pairs{fixedsize=memory.create, resizable=newresizable} do
 		check('\0\0b', '\0\0a\0', 3, false)
 	end
 
+	do print(kind, "memory.compare(m1, m2 [, i1 [, j1 [, i2 [, j2]]]]), m1 == m2, m1 < m2, m1 <= m2")
+		local function check(data, str, expected)
+			local b = newmem(data)
+			local m = newmem(str)
+			assert(memory.compare(b, str) == expected)
+			assert(memory.compare(b, m) == expected)
+			assert(memory.compare(str, b) == -expected)
+			assert((b == m) == (expected == 0))
+			assert((b < m) == (expected < 0))
+			assert((b <= m) == (expected <= 0))
+			assert((b < str) == (expected < 0))
+			assert((str <= b) == (expected >= 0))
+			assert((m > b) == (expected < 0))
+		end
+		check('', '', 0)
+		check('alo', 'alo1', -1)
+		check('alo\0alo', 'alo\0b', -1)
+		check('alo\0', 'alo', 1)
+		check('\0', '\255', -1)
+		check('\200', '\1', 1)
+		check(string.rep("x", 100), string.rep("x", 100), 0)
+		check(string.rep("x", 99).."a", string.rep("x", 100), -1)
+		check(string.rep("x", 70).."y"..string.rep("x", 29), string.rep("x", 100), 1)
+
+		local b = newmem("0123456789")
+		assert(memory.compare(b, "xx234", 3, 5, 3) == 0)
+		assert(memory.compare(b, "234", 3, 6) == 1)
+		assert(memory.compare(b, b, 1, 5, 6, 10) == -1)
+		assert(memory.compare(b, b, 6, 5, 20) == 0)
+		assert(b == b)
+		assert(b ~= "0123456789")  -- '__eq' is not called for strings
+		asserterr("string or memory expected", memory.compare, b, true)
+		asserterr("string or memory expected", function () return b < true end)
+	end
+
 	do print(kind, "memory.create(size)")
 		local function check(size)
 			checkmodifiable(memory.create(size), size)
@@ -317,10 +1107,96 @@ for kind, newmem in pairs{fixedsize=memory.create, resizable=newresizable} do
 				assert(memory.find(e, C2"", 1) == nil)
 				assert(memory.find(e, C2"", 2) == nil)
 				assert(memory.find(e, C2"aaa", 1) == nil)
+				assertret({1, 0}, memory.find(m, C2""))
+				assertret({5, 4}, memory.find(m, C2"", 5))
+				assertret({5, 4}, memory.find(m, C2"", 5, -1, 3))
+				assert(memory.find(m, C2"", 5, 1) == nil)
 			end
 		end
 	end
 
+	do print(kind, "memory:rfind(string [, i [, j [, o]]])")
+		for _, C1 in ipairs({tostring, memory.create}) do
+			for _, C2 in ipairs({tostring, memory.create}) do
+				local m = C1"1234567890123456789"
+				local e = C1""
+				local s = C2"345"
+				assertret({13, 15}, memory.rfind(m, s))
+				assertret({3, 5}, memory.rfind(m, s, 1, 14))
+				assertret({13, 15}, memory.rfind(m, s, 3))
+				assert(memory.rfind(m, s, 14) == nil)
+				assert(memory.rfind(m, C2"346") == nil)
+				assertret({3, 5}, memory.rfind(m, s, -19, -6))
+				assert(memory.rfind(m, s, 5, 1) == nil)
+				assertret({14, 15}, memory.rfind(m, s, 1, -1, 2))
+				assert(memory.rfind(m, s, 1, -1, 4) == nil)
+				assert(memory.rfind(e, C2"") == nil)
+				assert(memory.rfind(e, C2"aaa", 1) == nil)
+				assertret({20, 19}, memory.rfind(m, C2""))
+				assertret({6, 5}, memory.rfind(m, C2"", 1, 5))
+			end
+		end
+	end
+
+	do print(kind, "memory:findall(string [, i [, j]])")
+		for _, C1 in ipairs({tostring, memory.create}) do
+			for _, C2 in ipairs({tostring, memory.create}) do
+				local function collect(...)
+					local found = {}
+					for i, j in memory.findall(...) do
+						found[#found+1] = i..":"..j
+					end
+					return table.concat(found, " ")
+				end
+				local m = C1"1234567890123456789"
+				assert(collect(m, C2"345") == "3:5 13:15")
+				assert(collect(m, C2"345", 4) == "13:15")
+				assert(collect(m, C2"345", 1, 14) == "3:5")
+				assert(collect(m, C2"9") == "9:9 19:19")
+				assert(collect(m, C2"x") == "")
+				assert(collect(m, C2"") == "")
+				assert(collect(C1"", C2"a") == "")
+				assert(collect(C1"aaaaa", C2"aa") == "1:2 3:4")
+			end
+		end
+	end
+
+	do print(kind, "memory.searcher(s)")
+		local long = string.rep("ab", 40).."c"
+		for _, C1 in ipairs({tostring, memory.create}) do
+			for _, C2 in ipairs({tostring, memory.create}) do
+				local searcher = memory.searcher(C2"345")
+				assert(#searcher == 3)
+				local m = C1"1234567890123456789"
+				assertret({3, 5}, searcher:find(m))
+				assertret({13, 15}, searcher:find(m, 4))
+				assertret({13, 15}, searcher:rfind(m))
+				assertret({3, 5}, memory.find(m, searcher))
+				assertret({13, 15}, memory.rfind(m, searcher))
+				assert(searcher:find(m, 1, 4) == nil)
+				assert(searcher:find(C1"34") == nil)
+				local found = {}
+				for i, j in searcher:findall(m) do found[#found+1] = i end
+				assert(found[1] == 3 and found[2] == 13 and found[3] == nil)
+
+				local searcher = memory.searcher(C2(long))
+				local m = C1(string.rep("ab", 100).."c"..string.rep("ab", 100).."c")
+				assertret({121, 201}, searcher:find(m))
+				assertret({322, 402}, searcher:rfind(m))
+				assertret({322, 402}, memory.find(m, C2(long), 122))
+				assert(searcher:find(m, 1, 200) == nil)
+				local m = C1(string.rep("\0", 300))
+				assert(memory.find(m, C2(string.rep("\0", 40).."\1")) == nil)
+				assertret({1, 40}, memory.find(m, C2(string.rep("\0", 40))))
+				assertret({261, 300}, memory.rfind(m, C2(string.rep("\0", 40))))
+
+				assertret({1, 0}, memory.searcher(C2""):find(m))
+				assertret({301, 300}, memory.searcher(C2""):rfind(m))
+			end
+		end
+		asserterr("string or memory expected", memory.searcher, {})
+	end
+
 	do print(kind, "memory:fill(string [, i [, j]])")
 		local data = string.rep(" ", 10)
 		local full = "1234567890ABCDEF"
@@ -394,6 +1270,67 @@ for kind, newmem in pairs{fixedsize=memory.create, resizable=newresizable} do
 			memory.fill(b, b, 7, -1)
 			assert(memory.diff(b, "1234561234567890") == nil)
 		end
+		do  -- copies read the pattern changed by previous copies
+			local b = memory.create(full)
+			memory.fill(b, b, 1, -1, 14)
+			assert(memory.diff(b, "DEFDEFDEFDEFDEFE") == nil)
+		end
+		do
+			local b = memory.create(full)
+			memory.fill(b, b, 3, -1, 2)
+			assert(memory.diff(b, "12234567890ABCDE") == nil)
+		end
+		for _, size in ipairs{ 31, 32, 33, 100, 5000, 70000 } do
+			for _, pattern in ipairs{ "a", "ab", "abcd", "abc", full, full..full, full:rep(3).."x" } do
+				local b = newmem(size)
+				memory.fill(b, pattern)
+				assert(memory.diff(b, pattern:rep(size//#pattern+1):sub(1, size)) == nil)
+			end
+		end
+	end
+
+	do print(kind, "memory.band/bor/bxor/bnot(m, s [, i [, j [, o]]])")
+		local function xorstr(s, k)
+			return (s:gsub("()(.)", function (i, c)
+				local b = k:byte((i-1)%#k+1)
+				return string.char(c:byte() ~ b)
+			end))
+		end
+		local b = newmem(6)
+		memory.fill(b, "abcdef")
+		memory.bxor(b, 0x20)
+		assert(memory.diff(b, "ABCDEF") == nil)
+		memory.bxor(b, " ", 2, 3)
+		assert(memory.diff(b, "AbcDEF") == nil)
+		memory.bor(b, "xx  ", -2, -1, 3)
+		assert(memory.diff(b, "AbcDef") == nil)
+		memory.band(b, "\xdf")
+		assert(memory.diff(b, "ABCDEF") == nil)
+		memory.bnot(b, 1, 1)
+		assert(memory.diff(b, "\xbeBCDEF") == nil)
+		memory.bnot(b, 1, 1)
+		memory.bxor(b, "")
+		memory.bxor(b, "ab", 1, -1, 3)
+		assert(memory.diff(b, "ABCDEF") == nil)
+		memory.bxor(b, b)
+		assert(memory.diff(b, string.rep("\0", 6)) == nil)
+		asserterr("value out of range", memory.bxor, b, 256)
+		asserterr("memory expected", memory.bor, "abc", "x")
+		asserterr("memory expected", memory.bnot, "abc")
+
+		for _, size in ipairs{ 31, 32, 33, 100, 5000 } do
+			local data = string.rep("0123456789abcdef", size//16+1):sub(1, size)
+			for _, key in ipairs{ "\x5a", "ab", "abcd", "abc", string.rep("xyz", 100) } do
+				local b = newmem(size)
+				memory.fill(b, data)
+				memory.bxor(b, key)
+				assert(memory.diff(b, xorstr(data, key)) == nil)
+				memory.bnot(b)
+				memory.bnot(b)
+				memory.bxor(b, key)
+				assert(memory.diff(b, data) == nil)
+			end
+		end
 	end
 
 	--[[
@@ -566,6 +1503,8 @@ for kind, newmem in pairs{fixedsize=memory.create, resizable=newresizable} do
 		asserterr("too short", memory.unpack, memory.create(x:sub(1, -2)), "s")
 		asserterr("too short", memory.unpack, memory.create("abcd"), "c5")
 		asserterr("unfinished string for format 'z'", memory.unpack, memory.create(), "z")
+		asserterr("bad argument #2", memory.unpack, memory.create("abcd"), "c5")
+		asserterr("bad argument #2", memory.unpack, memory.create(), "z")
 		asserterr("out of limits", memory.pack, memory.create(103), "s100", 1, "alo")
 	end
 
@@ -608,6 +1547,45 @@ for kind, newmem in pairs{fixedsize=memory.create, resizable=newresizable} do
 		asserterr("invalid next option", memory.unpack, mem, "X i")
 	end
 
+	do print(kind, "memory.layout(fmt)")
+		local layout = memory.layout("<I4I2")
+		assert(layout:packsize() == 6)
+		assert(memory.layout(""):packsize() == 0)
+		assert(memory.layout("!4 bi4"):packsize() == 8)
+		asserterr("variable-length format", layout.packsize, memory.layout("<I4s2"))
+		asserterr("invalid format option 'r'", memory.layout, "i3r")
+		asserterr("out of limits", memory.layout, "i0")
+
+		local mem = memory.create(8)
+		assertret({true, 7}, layout:pack(mem, 1, 0x04030201, 0x0605))
+		assert(tostring(mem) == "\1\2\3\4\5\6\0\0")
+		assertret({0x04030201, 0x0605, 7}, layout:unpack(mem))
+		assertret({0x0605, 7}, memory.unpack(mem, memory.layout("<I2"), 5))
+
+		-- not enough space
+		assertret({false, 8, 0x0a09}, layout:pack(mem, 4, 0x08070605, 0x0a09))
+		assert(tostring(mem) == "\1\2\3\5\6\7\8\0")
+		assertret({false, 9, 0x0e0d}, memory.pack(mem, "<I2I2I2", 5, 0x0a09, 0x0c0b, 0x0e0d))
+		assert(tostring(mem) == "\1\2\3\5\9\10\11\12")
+		asserterr("too short", layout.unpack, layout, mem, 4)
+		asserterr("out of bounds", layout.pack, layout, mem, 10, 1, 2)
+
+		-- unaligned initial position
+		local aligned = memory.layout("!4 i4")
+		memory.fill(mem, 0)
+		assertret({true, 9}, aligned:pack(mem, 2, -1))
+		assert(tostring(mem) == "\0\0\0\0\255\255\255\255")
+		assertret({-1, 9}, aligned:unpack(mem, 2))
+
+		-- variable-length options
+		local strings = memory.layout("<s1z")
+		local mem = memory.create(10)
+		assertret({true, 11}, strings:pack(mem, 1, "abc", "12345"))
+		assert(tostring(mem) == "\3abc12345\0")
+		assertret({"abc", "12345", 11}, strings:unpack(mem))
+		assertret({false, 5, "123456"}, strings:pack(mem, 1, "abc", "123456"))
+	end
+
 	-- TODO: review the cases below to apply then to 'unpack'.
 	do print(kind, "memory.pack/unpack: initial position")
 		local mem = memory.create(string.pack("i4i4i4i4", 1, 2, 3, 4))
@@ -674,4 +1652,48 @@ do print "memory.resize(m, size [, s])"
 	assert(tostring(m) == "abcde\0\0\0\0\0")
 end
 
+do print "memory.reserve(m, n), memory.shrink(m), memory.capacity(m)"
+	local m = memory.create(3)
+	assert(memory.capacity(m) == 3)
+	asserterr("resizable memory expected", memory.reserve, m, 10)
+	asserterr("resizable memory expected", memory.shrink, m)
+	asserterr("memory expected", memory.capacity, "abc")
+
+	local m = memory.create()
+	assert(memory.capacity(m) == 0)
+	for i = 1, 100 do
+		memory.resize(m, i, "x")
+		assert(memory.len(m) == i)
+		assert(memory.capacity(m) >= i)
+	end
+	assert(memory.capacity(m) < 200)
+	assert(tostring(m) == string.rep("x", 100))
+
+	local capacity = memory.capacity(m)
+	memory.resize(m, 10)
+	assert(memory.capacity(m) == capacity)
+	memory.shrink(m)
+	assert(memory.capacity(m) == 10)
+	assert(tostring(m) == string.rep("x", 10))
+
+	memory.reserve(m, 100)
+	assert(memory.capacity(m) == 100)
+	assert(memory.len(m) == 10)
+	memory.reserve(m, 50)
+	assert(memory.capacity(m) == 100)
+	memory.resize(m, 100, m)
+	assert(memory.capacity(m) == 100)
+	assert(tostring(m) == string.rep("x", 100))
+
+	memory.resize(m, 0)
+	memory.shrink(m)
+	assert(memory.capacity(m) == 0)
+	memory.resize(m, 3)
+	assert(tostring(m) == "\0\0\0")
+
+	do local closeable<close> = m end
+	assert(memory.capacity(m) == 0)
+	asserterr("resizable memory expected", memory.reserve, m, 10)
+end
+
 print "OK"
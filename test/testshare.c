@@ -0,0 +1,116 @@
+/*
+** Shares memory between Lua states of different threads through tokens
+** of the C API, and checks that the shared memory is freed only when the
+** last reference to it is released. Tokens are the blocks allocated for
+** shared memories, so their release is seen by wrapping 'free' of the C
+** library linked with option '-Wl,--wrap=free' (see 'Makefile').
+**
+** Usage: testshare
+*/
+
+#include "luamem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <lualib.h>
+
+
+LUAMEMMOD_API int luaopen_memory (lua_State *L);
+
+void __real_free (void *p);
+
+static void *watched = NULL;  /* token whose release is checked */
+static int released = 0;
+
+void __wrap_free (void *p) {
+	if (p != NULL && p == watched) released = 1;
+	__real_free(p);
+}
+
+
+#define check(c)	((void)((c) || fail(#c, __LINE__)))
+
+static int fail (const char *cond, int line) {
+	fprintf(stderr, "testshare: line %d: check failed: %s\n", line, cond);
+	exit(EXIT_FAILURE);
+	return 0;
+}
+
+static void run (lua_State *L, const char *code) {
+	if (luaL_dostring(L, code) != LUA_OK) {
+		fprintf(stderr, "testshare: %s\n", lua_tostring(L, -1));
+		exit(EXIT_FAILURE);
+	}
+}
+
+static lua_State *newstate (void) {
+	lua_State *L = luaL_newstate();
+	check(L != NULL);
+	luaL_openlibs(L);
+	luaL_requiref(L, "memory", luaopen_memory, 1);
+	lua_pop(L, 1);  /* pop module */
+	return L;
+}
+
+static void *worker (void *token) {
+	lua_State *L = newstate();
+	luamem_attach(L, token);  /* takes over the reference of 'token' */
+	lua_setglobal(L, "m");
+	run(L, "assert(tostring(m) == 'hello') "
+	       "assert(memory.type(m) == 'other') "
+	       "memory.set(m, 1, 0x4a)");
+	lua_close(L);  /* releases the reference of the memory */
+	return NULL;
+}
+
+static void test_threads (void) {
+	lua_State *L = newstate();
+	pthread_t thread;
+	void *token;
+	lua_pushliteral(L, "hello");
+	token = luamem_share(L, -1);  /* copies the string */
+	lua_pop(L, 1);
+	watched = token;
+	released = 0;
+	luamem_attach(L, token);
+	lua_pushvalue(L, -1);
+	lua_setglobal(L, "m");
+	token = luamem_share(L, -1);  /* new reference to the same memory */
+	check(token == watched);
+	lua_pop(L, 1);
+	check(pthread_create(&thread, NULL, worker, token) == 0);
+	check(pthread_join(thread, NULL) == 0);
+	check(!released);
+	run(L, "assert(tostring(m) == 'Jello')");
+	lua_close(L);  /* releases the last reference */
+	check(released);
+}
+
+static void test_unshare (void) {
+	lua_State *L = newstate();
+	void *token;
+	lua_pushinteger(L, 16);
+	token = luamem_share(L, -1);  /* 16 bytes with zeros */
+	lua_pop(L, 1);
+	watched = token;
+	released = 0;
+	luamem_attach(L, token);
+	lua_pushvalue(L, -1);
+	lua_setglobal(L, "m");
+	token = luamem_share(L, -1);  /* token never attached */
+	lua_pop(L, 1);
+	run(L, "assert(tostring(m) == string.rep('\\0', 16))");
+	lua_close(L);
+	check(!released);
+	luamem_unshare(token);
+	check(released);
+}
+
+
+int main (void) {
+	test_threads();
+	test_unshare();
+	printf("OK\n");
+	return EXIT_SUCCESS;
+}